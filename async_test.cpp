@@ -0,0 +1,97 @@
+#include <sys/poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <fstream>
+#include <thread>
+#include <vector>
+#include "log.h"
+#include "str.h"
+#include "test.h"
+
+struct point {
+    int x, y;
+};
+std::ostream& operator<<(std::ostream& os, const point& p) {
+    return os << '(' << p.x << ", " << p.y << ')';
+}
+
+// not trivially copyable, rendered by the producer
+struct tag {
+    std::string s;
+};
+std::ostream& operator<<(std::ostream& os, const tag& t) {
+    return os << '<' << t.s << '>';
+}
+
+template <typename... ARGS>
+static std::string line(const ARGS&... args) {
+    using slog::operator""_fmt;
+    return slog::internal::format("{} #{} {} {:.1f} {} {} {:>4}"_fmt, args...);
+}
+
+int main(int argc, char* argv[]) {
+    using namespace slog;
+    const int n = argc < 2 ? 100000 : atoi(argv[1]);
+    const int k = 4;
+    const auto path = "/tmp/async_test.0.log"s;
+    const std::string big(50000, 'x');
+    unlink(path.c_str());
+
+    // the worker flushes the file when the child exits
+    if (fork() == 0) {
+        SizeRotate::Builder builder;
+        builder.set_size("1g"_b)
+            .set_name("async_test"s)
+            .set_base("/tmp"s)
+            .set_num_files(2)
+            .set_buf_size("64k"_b);
+        auto queue = Logger<SizeRotate>::Async(builder.Build(), 1024);
+        std::vector<std::thread> producers;
+        for (int t = 0; t < k; ++t) {
+            producers.emplace_back([&, t] {
+                for (int i = 0; i < n; ++i) {
+                    // gone before the worker formats it
+                    const std::string s = "s" + std::to_string(i);
+                    queue->Logf("{} #{} {} {:.1f} {} {} {:>4}\n"_fmt, t, i, s, i * 0.5,
+                                point{i, -i}, tag{s}, 'c');
+                    // spans many slots
+                    if (i % 10000 == 0) queue->Logf("{}:{}\n"_fmt, t, big);
+                }
+            });
+        }
+        for (auto& p : producers) p.join();
+        // larger than a ring record, pushed as text
+        queue->Logf("{}:{}\n"_fmt, k, std::string(200000, 'y'));
+        while (!queue->empty()) poll(nullptr, 0, 1);
+        exit(0);
+    }
+    int status;
+    wait(&status);
+    EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    std::ifstream in{path};
+    std::vector<int> next(k), bigs(k);
+    bool huge = false;
+    for (std::string s; std::getline(in, s);) {
+        const int t = s[0] - '0';
+        if (t == k) {
+            EXPECT_EQ(s, internal::format("{}:{}"_fmt, k, std::string(200000, 'y')));
+            huge = true;
+            continue;
+        }
+        EXPECT_TRUE(t >= 0 && t < k);
+        if (s[1] == ':') {
+            EXPECT_EQ(s.substr(2), big);
+            ++bigs[t];
+            continue;
+        }
+        const int i = next[t]++;
+        const auto str = "s" + std::to_string(i);
+        EXPECT_EQ(s, line(t, i, str, i * 0.5, point{i, -i}, tag{str}, 'c'));
+    }
+    for (int t = 0; t < k; ++t) {
+        EXPECT_EQ(next[t], n);
+        EXPECT_EQ(bigs[t], (n + 9999) / 10000);
+    }
+    EXPECT_TRUE(huge);
+}
@@ -0,0 +1,191 @@
+#include "binlog.h"
+#include <deque>
+#include <mutex>
+
+namespace slog::binlog {
+
+namespace {
+
+struct registry {
+    std::mutex m;
+    // ids are never reused, a deque keeps the entries in place
+    std::deque<std::pair<std::string_view, std::vector<type>>> sites;
+};
+
+registry& sites() {
+    static registry r;
+    return r;
+}
+
+template <typename T>
+bool take(std::string_view& p, T& t) {
+    if (p.size() < sizeof(T)) return false;
+    memcpy(&t, p.data(), sizeof(T));
+    p.remove_prefix(sizeof(T));
+    return true;
+}
+
+}  // namespace
+
+uint32_t add_site(std::string_view fmt, std::initializer_list<type> types) {
+    auto& r = sites();
+    std::scoped_lock lock{r.m};
+    r.sites.emplace_back(fmt, types);
+    return r.sites.size();
+}
+
+std::string definition(uint32_t id) {
+    auto& r = sites();
+    std::unique_lock lock{r.m};
+    const auto& [fmt, types] = r.sites[id - 1];
+    lock.unlock();
+
+    const uint16_t n = types.size();
+    const record_header h{0, (uint32_t)(sizeof(id) + sizeof(n) + n + fmt.size())};
+    std::string s;
+    s.reserve(sizeof(h) + h.size);
+    s.append((const char*)&h, sizeof(h));
+    s.append((const char*)&id, sizeof(id));
+    s.append((const char*)&n, sizeof(n));
+    s.append((const char*)types.data(), n);
+    s.append(fmt);
+    return s;
+}
+
+bool decoder::define(std::string_view p) {
+    uint32_t id;
+    uint16_t n;
+    if (!take(p, id) || !take(p, n) || id == 0 || p.size() < n) return false;
+    std::vector<type> types((const type*)p.data(), (const type*)p.data() + n);
+    p.remove_prefix(n);
+    if (id > sites_.size()) sites_.resize(id);
+    sites_[id - 1] = std::make_unique<site>(p, std::move(types));
+    return true;
+}
+
+bool decoder::render(const site& s, std::string_view p, std::string& out) {
+    union value {
+        signed char sc;
+        unsigned char uc;
+        char c;
+        bool b;
+        int16_t i16;
+        int32_t i32;
+        int64_t i64;
+        uint16_t u16;
+        uint32_t u32;
+        uint64_t u64;
+        float f32;
+        double f64;
+        const void* ptr;
+    };
+    const int n = s.types.size();
+    if (n > 64) return false;
+    value v[64];
+    std::string_view strs[64];
+    internal::fmt_arg args[64];
+
+    int64_t ns;
+    if (!take(p, ns)) return false;
+    for (int i = 0; i < n; ++i) {
+        auto scalar = [&](auto& x) {
+            if (!take(p, x)) return false;
+            args[i] = internal::make_arg(x);
+            return true;
+        };
+        bool ok = false;
+        switch (s.types[i]) {
+            case type::schar:
+                ok = scalar(v[i].sc);
+                break;
+            case type::uchar:
+                ok = scalar(v[i].uc);
+                break;
+            case type::chr:
+                ok = scalar(v[i].c);
+                break;
+            case type::boolean:
+                ok = scalar(v[i].b);
+                break;
+            case type::i16:
+                ok = scalar(v[i].i16);
+                break;
+            case type::i32:
+                ok = scalar(v[i].i32);
+                break;
+            case type::i64:
+                ok = scalar(v[i].i64);
+                break;
+            case type::u16:
+                ok = scalar(v[i].u16);
+                break;
+            case type::u32:
+                ok = scalar(v[i].u32);
+                break;
+            case type::u64:
+                ok = scalar(v[i].u64);
+                break;
+            case type::f32:
+                ok = scalar(v[i].f32);
+                break;
+            case type::f64:
+                ok = scalar(v[i].f64);
+                break;
+            case type::ptr:
+                ok = take(p, v[i].u64);
+                v[i].ptr = (const void*)(uintptr_t)v[i].u64;
+                args[i] = internal::make_arg(v[i].ptr);
+                break;
+            case type::str: {
+                uint32_t len;
+                if (!take(p, len) || p.size() < len) break;
+                strs[i] = p.substr(0, len);
+                p.remove_prefix(len);
+                args[i] = internal::make_arg(strs[i]);
+                ok = true;
+                break;
+            }
+        }
+        if (!ok) return false;
+    }
+
+    if (stamps_) {
+        char buf[32];
+        const auto k = internal::format_to(buf, sizeof(buf), "{}.{:09} "_fmt,
+                                           ns / 1000000000, ns % 1000000000);
+        out.append(buf, k);
+    }
+    // render in place, twice if the first guess is short
+    const auto at = out.size();
+    size_t room = 256;
+    for (;;) {
+        out.resize(at + room);
+        internal::fmt_out o{out.data() + at, room};
+        s.parser.apply(o, args, n);
+        if (o.size() <= room) {
+            out.resize(at + o.size());
+            return true;
+        }
+        room = o.size();
+    }
+}
+
+size_t decoder::decode(std::string_view in, std::string& out) {
+    size_t done = 0;
+    for (record_header h; in.size() - done >= sizeof(h);) {
+        memcpy(&h, in.data() + done, sizeof(h));
+        if (in.size() - done - sizeof(h) < h.size) break;
+        const auto p = in.substr(done + sizeof(h), h.size);
+        done += sizeof(h) + h.size;
+
+        if (h.site == 0) {
+            if (!define(p)) ++unknown_;
+        } else if (h.site > sites_.size() || !sites_[h.site - 1] ||
+                   !render(*sites_[h.site - 1], p, out)) {
+            ++unknown_;
+        }
+    }
+    return done;
+}
+
+}  // namespace slog::binlog
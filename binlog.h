@@ -0,0 +1,185 @@
+#pragma once
+
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <vector>
+#include "file.h"
+#include "str.h"
+
+namespace slog::binlog {
+
+/*
+   Binary log records, formatted offline. Each call site, a static format string with
+   its argument types, gets an id on first use; the hot path then copies the raw
+   arguments and nothing else.
+
+   A record is a header followed by `size` bytes, in native byte order:
+     site 0   definition: u32 id, u16 nargs, u8 types[nargs], the format string
+     site id  event: i64 nanoseconds since the epoch, the arguments
+   Integers, floats, chars and pointers are stored as is, strings as a u32 length and
+   the bytes. Any other type is rendered to a string when logged. Every segment
+   defines the sites it uses before their first event, so it decodes on its own.
+ */
+enum class type : uint8_t {
+    schar = 1,
+    uchar,
+    chr,
+    boolean,
+    i16,
+    i32,
+    i64,
+    u16,
+    u32,
+    u64,
+    f32,
+    f64,
+    ptr,
+    str,
+};
+
+struct record_header {
+    uint32_t site;
+    uint32_t size;
+};
+
+template <typename T>
+constexpr type code() {
+    if constexpr (std::is_constructible_v<std::string_view, const T&>) {
+        return type::str;
+    } else if constexpr (std::is_same_v<T, char>) {
+        return type::chr;
+    } else if constexpr (std::is_same_v<T, signed char>) {
+        return type::schar;
+    } else if constexpr (std::is_same_v<T, unsigned char>) {
+        return type::uchar;
+    } else if constexpr (std::is_same_v<T, bool>) {
+        return type::boolean;
+    } else if constexpr (std::is_same_v<T, short> || std::is_same_v<T, int> ||
+                         std::is_same_v<T, long> || std::is_same_v<T, long long>) {
+        return sizeof(T) == 2 ? type::i16 : sizeof(T) == 4 ? type::i32 : type::i64;
+    } else if constexpr (std::is_same_v<T, unsigned short> ||
+                         std::is_same_v<T, unsigned> ||
+                         std::is_same_v<T, unsigned long> ||
+                         std::is_same_v<T, unsigned long long>) {
+        return sizeof(T) == 2 ? type::u16 : sizeof(T) == 4 ? type::u32 : type::u64;
+    } else if constexpr (std::is_same_v<T, float>) {
+        return type::f32;
+    } else if constexpr (std::is_same_v<T, double>) {
+        return type::f64;
+    } else if constexpr (std::is_pointer_v<T> &&
+                         !std::is_function_v<std::remove_pointer_t<T>>) {
+        return type::ptr;
+    } else {
+        // rendered when logged
+        return type::str;
+    }
+}
+
+template <typename T>
+constexpr bool raw = code<T>() != type::str;
+
+// the argument as stored: itself, or its text for a type without a binary form
+template <typename T>
+decltype(auto) lower(const T& t) {
+    if constexpr (raw<T> || std::is_constructible_v<std::string_view, const T&>) {
+        return (t);
+    } else {
+        return internal::format("{}"_fmt, t);
+    }
+}
+
+template <typename T>
+size_t size_of(const T& t) {
+    if constexpr (!raw<T>) {
+        return sizeof(uint32_t) + std::string_view{t}.size();
+    } else if constexpr (code<T>() == type::ptr) {
+        return sizeof(uint64_t);
+    } else {
+        return sizeof(T);
+    }
+}
+
+template <typename T>
+char* put(char* p, const T& t) {
+    if constexpr (!raw<T>) {
+        std::string_view s{t};
+        const uint32_t n = s.size();
+        memcpy(p, &n, sizeof(n));
+        memcpy(p + sizeof(n), s.data(), n);
+        return p + sizeof(n) + n;
+    } else if constexpr (code<T>() == type::ptr) {
+        const uint64_t v = (uintptr_t)t;
+        memcpy(p, &v, sizeof(v));
+        return p + sizeof(v);
+    } else {
+        memcpy(p, &t, sizeof(t));
+        return p + sizeof(t);
+    }
+}
+
+// registers a site, ids start at 1
+uint32_t add_site(std::string_view fmt, std::initializer_list<type> types);
+// the definition record of site `id`
+std::string definition(uint32_t id);
+
+template <typename FMT, typename... ARGS>
+uint32_t site_id() {
+    static_assert(FMT::parsed.n_slots == sizeof...(ARGS),
+                  "binlog: argument count does not match the format string");
+    static const uint32_t id = add_site(FMT::view(), {code<ARGS>()...});
+    return id;
+}
+
+// writes an event of lowered arguments, returns the record size
+template <typename... ARGS>
+size_t write(File& f, uint32_t site, int64_t ns, const ARGS&... args) {
+    const record_header h{site, (uint32_t)(sizeof(ns) + (0 + ... + size_of(args)))};
+    const size_t n = sizeof(h) + h.size;
+    auto encode = [&](char* p) {
+        memcpy(p, &h, sizeof(h));
+        memcpy(p + sizeof(h), &ns, sizeof(ns));
+        p += sizeof(h) + sizeof(ns);
+        ((p = put(p, args)), ...);
+    };
+    if (auto p = f.Reserve(n)) {
+        encode(p);
+        f.Commit(n);
+    } else {
+        std::string s(n, '\0');
+        encode(s.data());
+        f.Write(s);
+    }
+    return n;
+}
+
+// renders records back to text, keeping the site definitions seen so far
+class decoder {
+    struct site {
+        std::string fmt;
+        std::vector<type> types;
+        internal::fmt_parser parser;
+        site(std::string_view f, std::vector<type> t)
+            : fmt{f}, types{std::move(t)}, parser{fmt} {}
+    };
+    std::vector<std::unique_ptr<site>> sites_;
+    bool stamps_;
+    uint64_t unknown_;
+
+    bool define(std::string_view p);
+    bool render(const site& s, std::string_view p, std::string& out);
+
+   public:
+    // `stamps` prefixes each event with its time
+    explicit decoder(bool stamps = false) : stamps_{stamps}, unknown_{0} {}
+
+    // appends the text of the records in `in` to `out` and returns the bytes consumed;
+    // a torn record at the end is left for the next call
+    size_t decode(std::string_view in, std::string& out);
+    // events of sites never defined, or not matching their definition
+    uint64_t unknown() const {
+        return unknown_;
+    }
+};
+
+}  // namespace slog::binlog
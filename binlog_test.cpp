@@ -0,0 +1,182 @@
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include "binlog.h"
+#include "log.h"
+#include "str.h"
+#include "test.h"
+
+struct point {
+    int x, y;
+};
+std::ostream& operator<<(std::ostream& os, const point& p) {
+    return os << '(' << p.x << ", " << p.y << ')';
+}
+
+static std::string slurp(const std::string& path) {
+    std::ifstream f{path};
+    return {std::istreambuf_iterator<char>{f}, {}};
+}
+
+static std::string decode(const std::string& path, uint64_t& unknown) {
+    slog::binlog::decoder d;
+    std::string out;
+    const auto in = slurp(path);
+    if (d.decode(in, out) != in.size()) ++unknown;
+    unknown += d.unknown();
+    return out;
+}
+
+template <typename F>
+static double ns_per_call(int n, F&& f) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < n; ++i) f(i);
+    auto d = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count() / (double)n;
+}
+
+int main(int argc, char* argv[]) {
+    using namespace slog;
+    const int n = argc < 2 ? 1000000 : atoi(argv[1]);
+
+    auto builder = [](std::string name, const char* size, int files) {
+        for (int i = 0; i < files; ++i) {
+            unlink(("/tmp/" + name + '.' + std::to_string(i) + ".bin").c_str());
+        }
+        SizeRotate::Builder b;
+        b.set_size(Bytes::of(size))
+            .set_name(std::move(name))
+            .set_base("/tmp"s)
+            .set_ext("bin"s)
+            .set_num_files(files)
+            .set_buf_size("64k"_b);
+        return b.Build();
+    };
+
+    // every supported type, rendered offline exactly as the text path does
+    {
+        std::string expected;
+        {
+            auto logger = Logger<SizeRotate>::of(builder("binlog_test", "1g", 2));
+            const std::string big(100000, 'b');
+            int x = 0;
+            for (int i = 0; i < 1000; ++i) {
+                const std::string s = "str" + std::to_string(i);
+                const point pt{i, -i};
+                logger->Logb("#{} {} {:>5} {:x} {:.3f} {} {} {}|{:<8}|{} {} {:p}\n"_fmt, i,
+                             (short)-i, (unsigned char)('a' + i % 26), (uint64_t)i * 977,
+                             i / 7.0, (float)i, i % 2 == 0, 'c', s, "lit", pt, &x);
+                expected += internal::format(
+                    "#{} {} {:>5} {:x} {:.3f} {} {} {}|{:<8}|{} {} {:p}\n"_fmt, i,
+                    (short)-i, (unsigned char)('a' + i % 26), (uint64_t)i * 977, i / 7.0,
+                    (float)i, i % 2 == 0, 'c', s, "lit", pt, &x);
+                if (i % 100 == 0) {
+                    // larger than the buffer
+                    logger->Logb("{}\n"_fmt, big);
+                    expected += big + '\n';
+                }
+            }
+        }
+        uint64_t unknown = 0;
+        EXPECT_EQ(decode("/tmp/binlog_test.0.bin", unknown), expected);
+        EXPECT_EQ(unknown, 0u);
+    }
+
+    // segments decode on their own
+    {
+        {
+            auto logger = Logger<SizeRotate>::of(builder("binlog_rotate", "64k", 3));
+            for (int i = 0; i < 20000; ++i) {
+                if (i % 3 == 0) {
+                    logger->Logb("#{} three\n"_fmt, i);
+                } else {
+                    logger->Logb("#{} {}\n"_fmt, i, "other"sv);
+                }
+            }
+        }
+        std::vector<std::string> texts;
+        for (int k = 0; k < 3; ++k) {
+            uint64_t unknown = 0;
+            texts.push_back(
+                decode("/tmp/binlog_rotate." + std::to_string(k) + ".bin", unknown));
+            EXPECT_EQ(unknown, 0u);
+            EXPECT_TRUE(!texts.back().empty());
+        }
+        std::sort(texts.begin(), texts.end(), [](auto& a, auto& b) {
+            return atoi(a.c_str() + 1) < atoi(b.c_str() + 1);
+        });
+        int next = -1;
+        for (auto& text : texts) {
+            std::istringstream in{text};
+            for (std::string line; std::getline(in, line);) {
+                const int i = atoi(line.c_str() + 1);
+                EXPECT_TRUE(next == -1 || i == next);
+                EXPECT_EQ(line, internal::format(i % 3 == 0 ? "#{} three"sv : "#{} other"sv,
+                                                 i));
+                next = i + 1;
+            }
+        }
+        EXPECT_EQ(next, 20000);
+    }
+
+    // resuming a segment keeps records ending in zero bytes, after a clean close or a
+    // crash that left the file preallocated or padded
+    for (auto backend : {"plain"s, "mmap"s, "direct"s}) {
+        const auto path = "/tmp/binlog_resume.0.bin"s;
+        unlink(path.c_str());
+        std::string expected;
+        for (int run = 0; run < 3; ++run) {
+            // the last run resumes after a crash
+            if (run == 2 && backend == "mmap") {
+                EXPECT_EQ(truncate(path.c_str(), 1 << 20), 0);
+            } else if (run == 2 && backend == "direct") {
+                EXPECT_EQ(truncate(path.c_str(), (slurp(path).size() + 4095) & ~4095), 0);
+            }
+            SizeRotate::Builder b;
+            b.set_size("1m"_b)
+                .set_name("binlog_resume"s)
+                .set_base("/tmp"s)
+                .set_ext("bin"s)
+                .set_num_files(1)
+                .set_mmap(backend == "mmap")
+                .set_o_direct(backend == "direct");
+            auto logger = Logger<SizeRotate>::of(b.Build());
+            for (int i = 0; i < 3; ++i) {
+                logger->Logb("v={}\n"_fmt, 0);
+                expected += "v=0\n";
+            }
+        }
+        uint64_t unknown = 0;
+        EXPECT_EQ(decode(path, unknown), expected);
+        EXPECT_EQ(unknown, 0u);
+    }
+
+    // the hot path: rendering alone, text into a file, binary into a file
+    {
+        char buf[256];
+        const auto s = "abcd-efg-hi-jk-lmn-opq-rst-uvw-xyz"sv;
+        size_t sink = 0;
+        const auto fmt = ns_per_call(n, [&](int i) {
+            sink += internal::format_to(buf, sizeof(buf),
+                                        "#{} {} {:.3f} this is a test: {}\n"_fmt, i,
+                                        i * 31u, i * 0.5, s);
+        });
+        auto text = Logger<SizeRotate>::of(builder("binlog_bench_text", "1g", 2));
+        const auto logf = ns_per_call(n, [&](int i) {
+            text->Logf("#{} {} {:.3f} this is a test: {}\n"_fmt, i, i * 31u, i * 0.5, s);
+        });
+        auto bin = Logger<SizeRotate>::of(builder("binlog_bench_bin", "1g", 2));
+        const auto logb = ns_per_call(n, [&](int i) {
+            bin->Logb("#{} {} {:.3f} this is a test: {}\n"_fmt, i, i * 31u, i * 0.5, s);
+        });
+        std::cout << internal::format(
+                         "internal::format: {:.1f} ns/call, Logf: {:.1f} ns/call, Logb: "
+                         "{:.1f} ns/call ({})"_fmt,
+                         fmt, logf, logb, sink != 0)
+                  << std::endl;
+    }
+}
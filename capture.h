@@ -0,0 +1,116 @@
+#pragma once
+
+#include <string.h>
+#include <new>
+#include <string>
+#include <tuple>
+#include "str.h"
+
+namespace slog::internal {
+
+/*
+   Format arguments captured by value, to be rendered on another thread. Strings are
+   copied as a u32 length and their bytes, other trivially copyable types as their
+   bytes; anything else is rendered to a string by the caller. A captured record is
+   the renderer of its format and argument types, followed by the arguments.
+ */
+template <typename T>
+constexpr bool capture_as_string = std::is_constructible_v<std::string_view, const T&> ||
+                                   !std::is_trivially_copyable_v<T>;
+
+template <typename T>
+using captured_t = std::conditional_t<capture_as_string<T>, std::string_view, T>;
+
+// the argument as captured: itself, or its text
+template <typename T>
+decltype(auto) capture(const T& t) {
+    if constexpr (std::is_constructible_v<std::string_view, const T&> ||
+                  std::is_trivially_copyable_v<T>) {
+        return (t);
+    } else {
+        return format("{}"_fmt, t);
+    }
+}
+
+template <typename T>
+size_t captured_size(const T& t) {
+    if constexpr (capture_as_string<T>) {
+        return sizeof(uint32_t) + std::string_view{t}.size();
+    } else {
+        return sizeof(T);
+    }
+}
+
+template <typename T>
+char* put_captured(char* p, const T& t) {
+    if constexpr (capture_as_string<T>) {
+        std::string_view s{t};
+        const uint32_t n = s.size();
+        memcpy(p, &n, sizeof(n));
+        memcpy(p + sizeof(n), s.data(), n);
+        return p + sizeof(n) + n;
+    } else {
+        memcpy(p, &t, sizeof(T));
+        return p + sizeof(T);
+    }
+}
+
+// a captured argument read back, records carry no alignment
+template <typename T>
+class uncaptured {
+    alignas(T) char b_[sizeof(T)];
+
+   public:
+    explicit uncaptured(const char*& p) {
+        memcpy(b_, p, sizeof(T));
+        p += sizeof(T);
+    }
+    const T& get() const {
+        return *std::launder(reinterpret_cast<const T*>(b_));
+    }
+};
+template <>
+class uncaptured<std::string_view> {
+    std::string_view s_;
+
+   public:
+    explicit uncaptured(const char*& p) {
+        uint32_t n;
+        memcpy(&n, p, sizeof(n));
+        s_ = {p + sizeof(n), n};
+        p += sizeof(n) + n;
+    }
+    std::string_view get() const {
+        return s_;
+    }
+};
+
+// renders the arguments at `p` into [out, out + n), returns the formatted size
+using renderer = size_t (*)(char* out, size_t n, const char* p);
+
+template <typename FMT, typename... Ts>
+size_t render_captured(char* out, size_t n, const char* p) {
+    // braced initialization reads the arguments in order
+    const std::tuple<uncaptured<Ts>...> t{uncaptured<Ts>{p}...};
+    return std::apply(
+        [&](const auto&... a) { return format_to(out, n, FMT{}, a.get()...); }, t);
+}
+
+// the size of the record of captured arguments `args`
+template <typename... ARGS>
+size_t captured_record_size(const ARGS&... args) {
+    return sizeof(renderer) + (0 + ... + captured_size(args));
+}
+
+// writes the record of captured arguments `args` to `p`
+template <typename FMT, typename... ARGS>
+void put_record(char* p, const ARGS&... args) {
+    static_assert(FMT::parsed.n_slots == sizeof...(ARGS),
+                  "format: argument count does not match the format string");
+    const renderer r = render_captured<FMT, captured_t<ARGS>...>;
+    memcpy(p, &r, sizeof(r));
+    p += sizeof(r);
+    ((p = put_captured(p, args)), ...);
+}
+
+}  // namespace slog::internal
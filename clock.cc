@@ -0,0 +1,80 @@
+#include "clock.h"
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace slog::internal {
+
+clock wall;
+
+// the kernel keeps the TSC as its clocksource only if it is stable across cpus
+static bool tsc_trusted() {
+#if defined(__x86_64__) || defined(__i386__)
+    char buf[16]{};
+    const int fd = open("/sys/devices/system/clocksource/clocksource0/current_clocksource",
+                        O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    const auto n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    return n >= 3 && strncmp(buf, "tsc", 3) == 0 && (n == 3 || buf[3] == '\n');
+#else
+    return false;
+#endif
+}
+
+int64_t clock::slow() {
+    auto m = mode_.load(std::memory_order_relaxed);
+    if (m == 0) {
+        m = tsc_trusted() ? 1 : -1;
+        mode_.store(m, std::memory_order_relaxed);
+    }
+    if (m < 0) return realtime();
+    // two bases `warmup` apart give the first rate
+    return sync(warmup);
+}
+
+int64_t clock::sync(int64_t min_age) {
+    // the narrowest of a few windows around clock_gettime
+    uint64_t t = 0;
+    int64_t ns = 0;
+    uint64_t best = ~0ull;
+    for (int i = 0; i < 3; ++i) {
+        const auto a = tsc();
+        const auto x = realtime();
+        const auto b = tsc();
+        if (b - a < best) {
+            best = b - a;
+            t = a + (b - a) / 2;
+            ns = x;
+        }
+    }
+    if (syncing_.exchange(true, std::memory_order_acquire)) return ns;
+
+    const auto base_tsc = base_tsc_.load(std::memory_order_relaxed);
+    const auto base_ns = base_ns_.load(std::memory_order_relaxed);
+    auto mult = mult_.load(std::memory_order_relaxed);
+    if (base_tsc && ns - base_ns < min_age) {
+        syncing_.store(false, std::memory_order_release);
+        return ns;
+    }
+    if (base_tsc && t > base_tsc && ns > base_ns) {
+        const uint64_t m = ((unsigned __int128)(ns - base_ns) << 32) / (t - base_tsc);
+        // a clock step is not a rate, keep the previous one
+        if (mult == 0 || (m > mult - mult / 100 && m < mult + mult / 100)) mult = m;
+    }
+
+    const auto s = seq_.load(std::memory_order_relaxed);
+    seq_.store(s + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    base_tsc_.store(t, std::memory_order_relaxed);
+    base_ns_.store(ns, std::memory_order_relaxed);
+    mult_.store(mult, std::memory_order_relaxed);
+    next_.store(mult ? t + ((uint64_t)interval << 32) / mult : 0,
+                std::memory_order_relaxed);
+    seq_.store(s + 2, std::memory_order_release);
+
+    syncing_.store(false, std::memory_order_release);
+    return ns;
+}
+
+}  // namespace slog::internal
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <time.h>
+#include <atomic>
+#include <cstdint>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace slog {
+
+namespace internal {
+
+/*
+   Wall clock in nanoseconds that reads the TSC instead of calling into the kernel.
+   A base pair (TSC, CLOCK_REALTIME) and the TSC rate, measured between the last two
+   bases, are published under a seqlock; a read extrapolates from the base. The first
+   read at least `interval` after the base takes a new one, as does the async worker on
+   its wakeups, so any thread keeps working without a background thread.
+
+   Staleness: a read is off CLOCK_REALTIME by the rate change since the last base, at
+   most `interval` × the rate error. That is well under 1 µs on a steady clock and
+   under 0.5 ms while NTP slews at its 500 ppm limit; a clock step shows up within
+   `interval`. Reads may go back by that error when a new base is taken. Without a
+   TSC the kernel trusts as its clocksource, reads are clock_gettime(CLOCK_REALTIME)
+   through the vDSO, exact at a few tens of nanoseconds.
+ */
+class clock {
+    static constexpr int64_t interval = 1000000000;  // ns between bases
+    static constexpr int64_t warmup = 10000000;      // ns before the first rate
+
+    std::atomic<uint32_t> seq_;
+    std::atomic<uint64_t> base_tsc_;
+    std::atomic<int64_t> base_ns_;
+    std::atomic<uint64_t> mult_;  // ns per tick, 32.32 fixed point, 0 until measured
+    std::atomic<uint64_t> next_;  // tsc of the next base
+    std::atomic<int> mode_;       // 0 unknown, 1 tsc, -1 clock_gettime
+    std::atomic_bool syncing_;
+
+    static uint64_t tsc() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return 0;
+#endif
+    }
+    int64_t slow();
+    // takes a new base unless one was taken less than `min_age` ago, returns the time
+    int64_t sync(int64_t min_age);
+
+   public:
+    constexpr clock()
+        : seq_{0}, base_tsc_{0}, base_ns_{0}, mult_{0}, next_{0}, mode_{0}, syncing_{false} {}
+
+    static int64_t realtime() {
+        timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        return ts.tv_sec * 1000000000ll + ts.tv_nsec;
+    }
+
+    int64_t now() {
+        for (;;) {
+            const auto s = seq_.load(std::memory_order_acquire);
+            const auto mult = mult_.load(std::memory_order_relaxed);
+            const auto base_tsc = base_tsc_.load(std::memory_order_relaxed);
+            const auto base_ns = base_ns_.load(std::memory_order_relaxed);
+            const auto next = next_.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if ((s & 1) || seq_.load(std::memory_order_relaxed) != s) continue;
+
+            if (mult == 0) return slow();
+            const auto t = tsc();
+            if (t >= next) return sync(interval);
+            // another cpu's TSC may lag a little
+            if (t < base_tsc) return base_ns;
+            return base_ns + (int64_t)(((unsigned __int128)(t - base_tsc) * mult) >> 32);
+        }
+    }
+    // keeps the base fresh so that readers stay off the slow path
+    void tick() {
+        if (mode_.load(std::memory_order_relaxed) > 0) sync(interval / 2);
+    }
+};
+
+extern clock wall;
+
+}  // namespace internal
+
+// nanoseconds since the epoch, see internal::clock for the accuracy
+inline int64_t current_nanos() {
+    return internal::wall.now();
+}
+inline int64_t current_seconds() {
+    return current_nanos() / 1000000000;
+}
+
+}  // namespace slog
@@ -0,0 +1,56 @@
+#include <time.h>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "clock.h"
+#include "test.h"
+
+template <typename F>
+static double ns_per_call(int n, F&& f) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < n; ++i) f();
+    auto d = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count() / (double)n;
+}
+
+int main(int argc, char* argv[]) {
+    using namespace slog;
+    const int64_t run_ns = argc < 2 ? 2500000000 : atoll(argv[1]);
+    const int64_t bound = 1000000;  // generous for virtual machines
+
+    // readings fall between CLOCK_REALTIME before and after, across several bases
+    std::vector<int64_t> worst(4);
+    std::vector<std::thread> readers;
+    for (int k = 0; k < (int)worst.size(); ++k) {
+        readers.emplace_back([&, k] {
+            const auto end = internal::clock::realtime() + run_ns;
+            for (int64_t before = 0; before < end;) {
+                before = internal::clock::realtime();
+                const auto t = current_nanos();
+                const auto after = internal::clock::realtime();
+                worst[k] = std::max({worst[k], before - t, t - after});
+            }
+        });
+    }
+    for (auto& t : readers) t.join();
+    const auto deviation = *std::max_element(worst.begin(), worst.end());
+    EXPECT_TRUE(deviation < bound);
+    EXPECT_TRUE(current_seconds() == internal::clock::realtime() / 1000000000 ||
+                current_seconds() + 1 == internal::clock::realtime() / 1000000000);
+
+    int64_t sink = 0;
+    const int n = 10000000;
+    const auto cached = ns_per_call(n, [&] { sink += current_nanos(); });
+    const auto realtime = ns_per_call(n, [&] { sink += internal::clock::realtime(); });
+    const auto coarse = ns_per_call(n, [&] {
+        timespec ts;
+        clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+        sink += ts.tv_nsec;
+    });
+    std::cout << "current_nanos: " << cached << " ns/call, CLOCK_REALTIME: " << realtime
+              << " ns/call, CLOCK_REALTIME_COARSE: " << coarse
+              << " ns/call, worst deviation: " << deviation << " ns (" << (sink != 0)
+              << ')' << std::endl;
+}
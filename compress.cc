@@ -0,0 +1,179 @@
+#include "compress.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <iostream>
+#include <memory>
+#include "str.h"
+#ifdef SLOG_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+namespace slog {
+
+#ifdef SLOG_HAVE_ZLIB
+const bool Compressor::available = true;
+#else
+const bool Compressor::available = false;
+#endif
+
+Compressor::Compressor(int level, int cpu)
+    : level_{level}, cpu_{std::max(1, std::min(cpu, 100))}, stop_{false} {
+    worker_ = std::thread{[this] { run(); }};
+}
+
+Compressor::~Compressor() {
+    {
+        std::scoped_lock lock{m_};
+        stop_ = true;
+    }
+    cv_.notify_all();
+    worker_.join();
+}
+
+void Compressor::Submit(std::string path, const struct stat& st) {
+    {
+        std::scoped_lock lock{m_};
+        todo_.push_back({std::move(path), st});
+    }
+    cv_.notify_all();
+}
+
+void Compressor::run() {
+    setpriority(PRIO_PROCESS, gettid(), 19);
+    std::unique_lock lock{m_};
+    for (;;) {
+        cv_.wait(lock, [this] { return stop_ || !todo_.empty(); });
+        if (stop_) return;
+        auto j = std::move(todo_.front());
+        todo_.pop_front();
+        lock.unlock();
+        if (!compress(j)) {
+            std::cerr << internal::format("compress {} failed: {}"sv, j.path, strerror(errno))
+                      << std::endl;
+        }
+        lock.lock();
+    }
+}
+
+#ifdef SLOG_HAVE_ZLIB
+
+static int64_t cpu_ns() {
+    timespec ts{};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static bool same(const struct stat& a, const struct stat& b) {
+    return a.st_dev == b.st_dev && a.st_ino == b.st_ino &&
+           a.st_ctim.tv_sec == b.st_ctim.tv_sec && a.st_ctim.tv_nsec == b.st_ctim.tv_nsec;
+}
+
+static bool write_all(int fd, const char* p, size_t n) {
+    while (n > 0) {
+        auto r = write(fd, p, n);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        p += r;
+        n -= r;
+    }
+    return true;
+}
+
+bool Compressor::compress(const job& j) {
+    constexpr size_t chunk = 256 * 1024;
+    auto& path = j.path;
+    int in = open(path.c_str(), O_RDONLY);
+    // removed or compressed already
+    if (in < 0) return errno == ENOENT;
+    struct stat a {}, b {};
+    // reused as a new segment since
+    if (fstat(in, &a) != 0 || !same(a, j.st)) {
+        close(in);
+        return true;
+    }
+    const auto dst = path + std::string{ext};
+    const auto tmp = dst + ".tmp";
+    int out = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0) {
+        close(in);
+        return false;
+    }
+
+    z_stream z{};
+    if (deflateInit2(&z, level_, Z_DEFLATED, 15 + 16 /* gzip */, 8, Z_DEFAULT_STRATEGY) !=
+        Z_OK) {
+        // the segment stays as it is
+        close(out);
+        unlink(tmp.c_str());
+        close(in);
+        errno = EINVAL;
+        return false;
+    }
+    auto ibuf = std::make_unique<char[]>(chunk);
+    auto obuf = std::make_unique<char[]>(chunk);
+    bool ok = true;
+    for (int flush = Z_NO_FLUSH; ok && flush != Z_FINISH;) {
+        const auto start = cpu_ns();
+        auto n = read(in, ibuf.get(), chunk);
+        if (n < 0) {
+            ok = errno == EINTR;
+            continue;
+        }
+        flush = n == 0 ? Z_FINISH : Z_NO_FLUSH;
+        z.next_in = (Bytef*)ibuf.get();
+        z.avail_in = n;
+        do {
+            z.next_out = (Bytef*)obuf.get();
+            z.avail_out = chunk;
+            const int r = deflate(&z, flush);
+            // finishing with room to spare must end the stream
+            if ((r != Z_OK && r != Z_BUF_ERROR && r != Z_STREAM_END) ||
+                (flush == Z_FINISH && z.avail_out != 0 && r != Z_STREAM_END)) {
+                errno = EIO;
+                ok = false;
+                break;
+            }
+            ok = write_all(out, obuf.get(), chunk - z.avail_out);
+        } while (ok && z.avail_out == 0);
+
+        // sleep off what exceeds the cpu share
+        const auto used = cpu_ns() - start;
+        const auto idle = used * (100 - cpu_) / cpu_;
+        timespec ts{idle / 1000000000L, idle % 1000000000L};
+        nanosleep(&ts, nullptr);
+        if (stop_) ok = false;
+    }
+    deflateEnd(&z);
+    ok = ok && fdatasync(out) == 0;
+    close(out);
+
+    close(in);
+    if (!ok) {
+        unlink(tmp.c_str());
+        return stop_;
+    }
+    if (rename(tmp.c_str(), dst.c_str()) != 0) return false;
+    // the segment was reused meanwhile, the output is stale
+    if (stat(path.c_str(), &b) != 0 || !same(a, b)) {
+        unlink(dst.c_str());
+        return true;
+    }
+    return unlink(path.c_str()) == 0;
+}
+
+#else
+
+bool Compressor::compress(const job&) {
+    return true;
+}
+
+#endif
+
+}  // namespace slog
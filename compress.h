@@ -0,0 +1,48 @@
+#pragma once
+
+#include <sys/stat.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace slog {
+
+/*
+   Gzips rotated segments on a low priority background thread and replaces each one
+   atomically: the output is renamed to `<path>.gz` before the segment is removed. The
+   thread is held to `cpu` percent of one core. Needs zlib at build time, otherwise
+   segments are left as they are.
+ */
+class Compressor {
+    const int level_;
+    const int cpu_;
+    struct job {
+        std::string path;
+        struct stat st;
+    };
+
+    std::deque<job> todo_;
+    std::atomic<bool> stop_;
+    std::mutex m_;
+    std::condition_variable cv_;
+    std::thread worker_;
+
+    void run();
+    bool compress(const job& j);
+
+   public:
+    static constexpr std::string_view ext = ".gz";
+    static const bool available;
+
+    Compressor(int level, int cpu);
+    ~Compressor();
+
+    // `path` must be closed and is skipped unless it is still the file `st` describes,
+    // inode numbers alone are reused; pending segments are dropped on shutdown
+    void Submit(std::string path, const struct stat& st);
+};
+
+}  // namespace slog
@@ -0,0 +1,66 @@
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef SLOG_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#include <stdio.h>
+#include <string>
+#include "binlog.h"
+#include "frame.h"
+
+// renders binary log segments as text: slog_decode [-t] segment...
+int main(int argc, char* argv[]) {
+    using namespace slog;
+    int i = 1;
+    const bool stamps = argc > 1 && argv[1] == "-t"sv;
+    if (stamps) ++i;
+    if (i == argc) {
+        fprintf(stderr, "usage: %s [-t] segment...\n", argv[0]);
+        return 2;
+    }
+
+    int status = 0;
+    for (; i < argc; ++i) {
+        const int fd = open(argv[i], O_RDONLY);
+        if (fd < 0) {
+            perror(argv[i]);
+            status = 1;
+            continue;
+        }
+        // every segment defines its own sites
+        binlog::decoder d{stamps};
+        std::string in, out;
+        auto feed = [&](std::string_view s) {
+            in.append(s);
+            in.erase(0, d.decode(in, out));
+            fwrite(out.data(), 1, out.size(), stdout);
+            out.clear();
+        };
+
+        uint32_t magic = 0;
+        if (pread(fd, &magic, sizeof(magic), 0) == sizeof(magic) &&
+            magic == frame_header::magic_v1) {
+            frame_header h;
+            std::string raw;
+            while (read_frame(fd, h, &raw)) feed(raw);
+            close(fd);
+        } else {
+            char buf[64 * 1024];
+#ifdef SLOG_HAVE_ZLIB
+            // reads plain segments as they are
+            auto z = gzdopen(fd, "rb");
+            for (int n; z && (n = gzread(z, buf, sizeof(buf))) > 0;) feed({buf, (size_t)n});
+            if (z) gzclose(z);
+#else
+            for (ssize_t n; (n = read(fd, buf, sizeof(buf))) > 0;) feed({buf, (size_t)n});
+            close(fd);
+#endif
+        }
+        if (!in.empty() || d.unknown()) {
+            fprintf(stderr, "%s: %zu torn bytes, %llu undecodable records\n", argv[i],
+                    in.size(), (unsigned long long)d.unknown());
+            status = 1;
+        }
+    }
+    return status;
+}
@@ -0,0 +1,111 @@
+#include "direct.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+
+namespace slog {
+
+DirectFile::DirectFile(int fd, int size, std::unique_ptr<char, decltype(&free)> mem)
+    : File{fd, Buf::of(mem.get(), size)},
+      mem_{std::move(mem)},
+      off_{0},
+      padded_{0} {
+    const auto end = lseek(fd, 0, SEEK_CUR);
+    if (end <= 0) return;
+    off_ = end & ~(block - 1);
+    if (off_ == (uint64_t)end) return;
+
+    // resume inside the partial last block
+    auto n = pread(fd, mem_.get(), block, off_);
+    if (n < 0) n = 0;
+    buf_.Commit(n);
+}
+
+DirectFile::~DirectFile() {
+    Close();
+    // the base class flushes an empty buffer
+    buf_ = Buf::of(nullptr, 0);
+}
+
+bool DirectFile::write_at(const char* p, size_t n, uint64_t off) {
+    while (n > 0) {
+        auto r =
+            internal::counted_write(metrics_, [&] { return pwrite(fd_, p, n, off); });
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        p += r;
+        off += r;
+        n -= r;
+    }
+    return true;
+}
+
+bool DirectFile::Drain() {
+    auto r = buf_.Rewind();
+    const size_t whole = r.size() & ~(block - 1);
+    const bool ok = whole == 0 || write_at(r.data(), whole, off_);
+    if (whole > 0) {
+        off_ += whole;
+        padded_ = 0;
+    }
+    const size_t tail = r.size() - whole;
+    memmove(mem_.get(), r.data() + whole, tail);
+    buf_.Commit(tail);
+    return ok;
+}
+
+bool DirectFile::DrainTail() {
+    const size_t n = buf_.Tail() - mem_.get();
+    if (n == padded_) return true;
+    const size_t padded = (n + block - 1) & ~(block - 1);
+    memset(buf_.Tail(), 0, padded - n);
+    if (!write_at(mem_.get(), padded, off_)) return false;
+    padded_ = n;
+    return ftruncate(fd_, off_ + n) == 0;
+}
+
+bool DirectFile::Put(std::string_view s) {
+    // through the aligned buffer, which holds less than a block after Drain
+    while (!s.empty()) {
+        const auto n = std::min<size_t>(buf_.Room(), s.size());
+        memcpy(buf_.Tail(), s.data(), n);
+        buf_.Commit(n);
+        s.remove_prefix(n);
+        if (!s.empty() && !Drain()) return false;
+    }
+    return true;
+}
+
+ssize_t DirectFile::Splice(int, size_t) {
+    errno = EINVAL;
+    return -1;
+}
+
+std::shared_ptr<File> DirectFile::of(int fd, int buf_size) {
+    struct stat st {};
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) return nullptr;
+
+    // whole blocks, at least two so a full buffer always drains something
+    const size_t size = std::max((buf_size + block - 1) & ~(block - 1), 2 * block);
+    void* p{};
+    if (posix_memalign(&p, block, size) != 0) return nullptr;
+    std::unique_ptr<char, decltype(&free)> mem{(char*)p, &free};
+
+    // Flush truncates the padding it writes, a crash in between leaves the file block
+    // aligned with a zero tail
+    const auto end = lseek(fd, 0, SEEK_CUR);
+    if (end > 0 && (end & (block - 1)) == 0) {
+        const auto n = DataEnd(fd, end);
+        if (n != (uint64_t)end && ftruncate(fd, n) == 0) lseek(fd, n, SEEK_SET);
+    }
+    const int flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_DIRECT) != 0) return nullptr;
+    return std::make_shared<trampoline<DirectFile>>(fd, (int)size, std::move(mem));
+}
+
+}  // namespace slog
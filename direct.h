@@ -0,0 +1,46 @@
+#pragma once
+
+#include <memory>
+#include "file.h"
+
+namespace slog {
+
+/*
+   File backend writing with O_DIRECT, bypassing the page cache. Drain writes whole
+   blocks from an aligned buffer and keeps the partial last block buffered; Flush and
+   close write it zero padded and truncate the file to the real size, the next Drain
+   rewrites that block. Resuming a file reloads its partial last block, after dropping
+   the padding a crash left.
+ */
+class DirectFile : public File {
+    static constexpr size_t block = 4096;
+
+    std::unique_ptr<char, decltype(&free)> mem_;
+    uint64_t off_;    // file offset of the buffer, block aligned
+    size_t padded_;  // buffered bytes already written by DrainTail
+
+    bool write_at(const char* p, size_t n, uint64_t off);
+
+   protected:
+    bool Drain() override;
+    bool DrainTail() override;
+    bool Put(std::string_view s) override;
+    // nothing cached to write back or drop
+    bool Writeback() override {
+        return true;
+    }
+
+    DirectFile(int fd, int size, std::unique_ptr<char, decltype(&free)> mem);
+    friend class trampoline<DirectFile>;
+
+   public:
+    ~DirectFile() override;
+
+    // splice() cannot feed O_DIRECT, fails with EINVAL so callers fall back to read()
+    ssize_t Splice(int fd, size_t n) override;
+
+    // nullptr if `fd` is not a regular file or its file system lacks O_DIRECT
+    static std::shared_ptr<File> of(int fd, int buf_size);
+};
+
+}  // namespace slog
@@ -2,14 +2,25 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <unistd.h>
 #include <algorithm>
+#include <array>
 #include <iostream>
 #include <sstream>
+#include "binlog.h"
+#include "clock.h"
+#include "compress.h"
+#include "direct.h"
+#include "flusher.h"
+#include "frame.h"
 #include "iter.h"
+#include "mapped.h"
+#include "prepare.h"
 #include "str.h"
+#include "uring.h"
 
 namespace slog {
 
@@ -38,69 +49,208 @@ Buf Buf::of(std::string& s) {
     return {s.data(), (int)s.size()};
 }
 
-File::File(int fd, Buf buf) : fd_{fd}, buf_{buf} {}
+File::File(int fd, Buf buf)
+    : fd_{fd},
+      buf_{buf},
+      durability_{Durability::flush},
+      fadvise_{false},
+      closed_{false},
+      first_{0},
+      last_{0},
+      synced_{0},
+      advised_{0},
+      retry_{0},
+      metrics_{nullptr} {}
 
 File::~File() {
-    Flush();
+    Close();
     if (fd_ != -1) close(fd_);
+    if (on_close_) on_close_();
 }
 
-#define _write(_s)                                                \
-    do {                                                          \
-        if (_s.empty()) break;                                    \
-        if (write(fd_, _s.data(), _s.size()) == -1) return false; \
+void File::set_durability(Durability d, bool fadvise) {
+    durability_ = d;
+    fadvise_ = fadvise;
+    if (fd_ != -1) synced_ = advised_ = retry_ = lseek(fd_, 0, SEEK_CUR);
+}
+
+#define _write(_s)                                                       \
+    do {                                                                 \
+        if (_s.empty()) break;                                           \
+        auto _n = internal::counted_write(                               \
+            metrics_, [&] { return write(fd_, _s.data(), _s.size()); }); \
+        if (_n == -1) return false;                                      \
     } while (false)
 
 bool File::Write(std::string_view s) {
     if (buf_.Write(s)) return true;
+    full(s.size());
+    if (!Drain()) return false;
+    if (buf_.Write(s)) return true;
+    return Put(s);
+}
 
+bool File::Drain() {
     auto r = buf_.Rewind();
     _write(r);
+    return true;
+}
+
+bool File::Put(std::string_view s) {
     _write(s);
     return true;
 }
 
 bool File::Flush() {
-    auto r = buf_.Rewind();
-    _write(r);
+    SLOG_PROBE(flush_start, fd_);
+    const bool ok = [this] {
+        if (!Drain() || !DrainTail()) return false;
+        switch (durability_) {
+            case Durability::writeback:
+                return Writeback();
+            case Durability::flush:
+                return Datasync();
+            default:
+                return true;
+        }
+    }();
+    SLOG_PROBE(flush_end, fd_, (int)ok);
+    return ok;
+}
 
-    return fdatasync(fd_) == 0;
+void File::Close() {
+    if (closed_) return;
+    closed_ = true;
+    if (Drain()) DrainTail();
+    switch (durability_) {
+        case Durability::writeback:
+            Writeback();
+            break;
+        case Durability::rotate:
+        case Durability::flush:
+            Datasync();
+            break;
+        default:
+            break;
+    }
 }
 
-std::shared_ptr<File> File::of(const char* path, Buf buf, bool append) {
-    int fd = open(path, O_WRONLY | O_CREAT | std::array{O_TRUNC, O_APPEND}[append], 0644);
+bool File::Datasync() {
+    if (metrics_) metrics_->syncs.fetch_add(1, std::memory_order_relaxed);
+    if (fdatasync(fd_) != 0) return false;
+    // all clean now
+    if (fadvise_) posix_fadvise(fd_, 0, 0, POSIX_FADV_DONTNEED);
+    return true;
+}
+
+int64_t File::Tell() {
+    return lseek(fd_, 0, SEEK_CUR);
+}
+
+bool File::Writeback() {
+    const auto end = Tell();
+    if (end < 0) return false;
+    // the range started by the previous call is most likely on disk by now
+    if (fadvise_) Advise(synced_);
+    if ((uint64_t)end <= synced_) return true;
+    const bool ok =
+        sync_file_range(fd_, synced_, end - synced_, SYNC_FILE_RANGE_WRITE) == 0;
+    synced_ = end;
+    return ok;
+}
+
+void File::Advise(uint64_t end) {
+    if (end <= advised_) return;
+    // DONTNEED skips pages still under writeback, the last range is dropped again
+    // along with this one instead of waiting for them
+    posix_fadvise(fd_, retry_, end - retry_, POSIX_FADV_DONTNEED);
+    retry_ = advised_;
+    advised_ = end;
+}
+
+ssize_t File::Splice(int fd, size_t n) {
+    if (!Drain()) return -1;
+    return splice(fd, nullptr, fd_, nullptr, n, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+}
+
+int File::Open(const char* path, bool append, bool read) {
+    // seek instead of O_APPEND, which splice() rejects; the file has a single writer
+    int fd = open(path, (read ? O_RDWR : O_WRONLY) | O_CREAT | (append ? 0 : O_TRUNC),
+                  0644);
+    if (fd >= 0 && append) lseek(fd, 0, SEEK_END);
     if (fd < 0) {
         std::cerr << internal::format("fallback to stdout: open {} failed: {}"sv, path,
                                       strerror(errno))
                   << std::endl;
         fd = dup(STDOUT_FILENO);
     }
+    return fd;
+}
 
-    return of(fd, buf);
+std::shared_ptr<File> File::of(const char* path, Buf buf, bool append) {
+    return of(Open(path, append), buf);
 }
 
 std::shared_ptr<File> File::of(int fd, Buf buf) {
     return std::make_shared<trampoline<File>>(fd, buf);
 }
 
+uint64_t File::DataEnd(int fd, uint64_t end) {
+    if (end == 0) return 0;
+    auto p = (const char*)mmap(nullptr, end, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) return end;
+    uint64_t n = end;
+    if (p[end - 1] == '\0' && p[0] == '\0') {
+        // a binary log opens with a site definition, its records may end in zeros; the
+        // tail reads as an empty record, a torn record is dropped too
+        binlog::record_header h;
+        for (n = 0; end - n >= sizeof(h); n += sizeof(h) + h.size) {
+            memcpy(&h, p + n, sizeof(h));
+            if (h.size == 0 || h.size > end - n - sizeof(h)) break;
+        }
+    } else {
+        while (n > 0 && p[n - 1] == '\0') --n;
+    }
+    munmap((void*)p, end);
+    return n;
+}
+
 auto RotatePolicy::Builder::set_buf_size(Bytes bytes) -> Builder& {
-    buf_size_ = bytes.value();
+    o_.buf_size = bytes.value();
     return *this;
 }
 
-RotatePolicy::RotatePolicy(std::string base, std::string name, std::string ext, int n,
-                           int buf_size)
+auto RotatePolicy::Builder::set_pipe_size(Bytes bytes) -> Builder& {
+    o_.pipe_size = bytes.value();
+    return *this;
+}
+
+auto RotatePolicy::Builder::set_max_line(Bytes bytes) -> Builder& {
+    o_.max_line = bytes.value();
+    return *this;
+}
+
+auto RotatePolicy::Builder::set_line_timeout(Seconds seconds) -> Builder& {
+    o_.line_timeout = seconds.value();
+    return *this;
+}
+
+auto RotatePolicy::Builder::set_overload(Overload overload, Bytes spill) -> Builder& {
+    return set_overload(overload, spill.value());
+}
+
+RotatePolicy::RotatePolicy(std::string base, std::string name, std::string ext, Options o)
     : base_{std::move(base)},
       name_{std::move(name)},
       ext_{std::move(ext)},
-      n_{n},
-      buf_size_{buf_size} {
+      o_{o},
+      loss_{std::make_shared<Loss>()} {
     slink_ = Path(""s);
 }
 
 std::vector<std::string> RotatePolicy::Probe() const {
     decltype(Probe()) r;
-    r.reserve(n_);
+    r.reserve(o_.n);
     unlink(slink_.c_str());
 
     internal::iter(
@@ -108,7 +258,14 @@ std::vector<std::string> RotatePolicy::Probe() const {
         [&](auto e) -> int {
             if (e->d_type != DT_REG) return 0;
             std::string_view s{e->d_name};
-            if (!internal::starts_with(s, name_)) return 0;
+            // not a longer name sharing the prefix
+            if (!internal::starts_with(s, name_) || s.size() <= name_.size() ||
+                s[name_.size()] != '.') {
+                return 0;
+            }
+            if (o_.compress && internal::ends_with(s, Compressor::ext)) {
+                s.remove_suffix(Compressor::ext.size());
+            }
             if (!internal::ends_with(s, ext_)) return 0;
             s.remove_prefix(name_.size() + 1);
             s.remove_suffix(ext_.size() + 1);
@@ -120,6 +277,9 @@ std::vector<std::string> RotatePolicy::Probe() const {
                       << std::endl;
         });
 
+    // a segment may exist both plain and compressed
+    std::sort(r.begin(), r.end());
+    r.erase(std::unique(r.begin(), r.end()), r.end());
     return r;
 }
 
@@ -131,8 +291,106 @@ std::string RotatePolicy::Path(std::string_view tag) const {
     return ss.str();
 }
 
+std::shared_ptr<File> RotatePolicy::Open(const std::string& path, std::string& buf,
+                                         bool append, uint64_t size) const {
+    // O_DIRECT and frames read back the end of the file when resuming
+    return Wrap(File::Open(path.c_str(), append, o_.o_direct || o_.frames), buf, size);
+}
+
+std::shared_ptr<File> RotatePolicy::Wrap(int fd, std::string& buf, uint64_t size) const {
+    auto f = [&]() -> std::shared_ptr<File> {
+        if (o_.frames) {
+            if (auto f = FrameFile::of(fd, o_.buf_size, o_.frames)) return f;
+        }
+        if (o_.mmap) {
+            if (auto f = MappedFile::of(fd, size)) return f;
+        }
+        if (o_.o_direct) {
+            if (auto f = DirectFile::of(fd, o_.buf_size)) return f;
+        }
+        if (o_.io_uring > 0) {
+            if (auto f = UringFile::of(fd, o_.buf_size, o_.io_uring)) return f;
+        }
+        if (o_.flush_bufs > 0) {
+            if (!flusher_) {
+                flusher_ = std::make_shared<Flusher>(o_.buf_size, o_.flush_bufs);
+            }
+            return AsyncFile::of(fd, flusher_);
+        }
+        return File::of(fd, Buf::of(buf));
+    }();
+    f->set_durability(o_.durability, o_.fadvise);
+    return f;
+}
+
+void RotatePolicy::Prepare(int64_t key, const std::string& path, const std::string& drop,
+                           std::string target, bool append, uint64_t size) const {
+    if (!o_.prepare) return;
+    if (!preparer_) preparer_ = std::make_shared<Preparer>();
+    std::vector<std::string> v;
+    if (!drop.empty()) v.push_back(drop);
+    if (!drop.empty() && o_.compress) v.push_back(drop + std::string{Compressor::ext});
+    preparer_->Prepare({key, path, std::move(v), slink_ + ".next", std::move(target),
+                        append, o_.o_direct || o_.frames, o_.mmap ? size : 0});
+}
+
+std::shared_ptr<File> RotatePolicy::Take(int64_t key, std::string& buf,
+                                         uint64_t size) const {
+    if (!preparer_) return nullptr;
+    int fd = preparer_->Take(key);
+    if (fd < 0) return nullptr;
+    rename((slink_ + ".next").c_str(), slink_.c_str());
+    return Wrap(fd, buf, size);
+}
+
+void RotatePolicy::Remove(const std::string& path) const {
+    unlink(path.c_str());
+    if (o_.compress) unlink((path + std::string{Compressor::ext}).c_str());
+}
+
+std::shared_ptr<Compressor>& RotatePolicy::compressor() const {
+    if (!compressor_) compressor_ = std::make_shared<Compressor>(o_.compress, o_.compress_cpu);
+    return compressor_;
+}
+
+void RotatePolicy::Compress(std::string path) const {
+    // frames are compressed already
+    if (!o_.compress || o_.frames || !Compressor::available) return;
+    struct stat st {};
+    if (stat(path.c_str(), &st) != 0) return;
+    compressor()->Submit(std::move(path), st);
+}
+
+void RotatePolicy::Retire(File& f, std::string path) const {
+    if (!o_.compress || o_.frames || !Compressor::available) return;
+    // `path` names it until the next rotation, and is final once closed
+    f.set_on_close([c = compressor(), path = std::move(path)] {
+        struct stat st {};
+        if (stat(path.c_str(), &st) == 0) c->Submit(path, st);
+    });
+}
+
+uint64_t RotatePolicy::blocked_ns() const {
+    return flusher_ ? flusher_->blocked_ns() : 0;
+}
+
+// a zlib level, or 0 with a complaint
+static int zlib_level(std::string_view what, int level) {
+    if (level >= -1 && level <= 9) return level;
+    std::cerr << internal::format("{} level {} out of range, disabled"sv, what, level)
+              << std::endl;
+    return 0;
+}
+
 RotatePolicy RotatePolicy::Builder::Build() {
-    return {std::move(base_), std::move(name_), std::move(ext_), n_, buf_size_};
+    o_.compress = zlib_level("compress"sv, o_.compress);
+    o_.frames = zlib_level("frames"sv, o_.frames);
+    // a stall is only visible with the writes off the caller's thread
+    if (o_.flush_bufs < 0) {
+        o_.flush_bufs = o_.overload != Overload::block && !o_.io_uring ? 4 : 0;
+    }
+    if (o_.flush_bufs == 1) o_.flush_bufs = 2;
+    return {std::move(base_), std::move(name_), std::move(ext_), o_};
 }
 
 static bool operator<(struct timespec lhs, struct timespec rhs) {
@@ -160,6 +418,10 @@ class latest_file {
     auto size() const {
         return size_;
     }
+    // drops the preallocated tail a crash left behind
+    void recover(uint64_t size) {
+        size_ = MappedFile::Recover(name_.c_str(), size);
+    }
     bool trivial() const {
         return name_.empty();
     }
@@ -188,30 +450,59 @@ SizeRotate::SizeRotate(RotatePolicy policy, uint64_t size)
         auto f = policy_.Path(s);
         if (*e || i >= n) {
             // remove unrelated files
-            unlink(f.c_str());
+            policy_.Remove(f);
             continue;
         }
         if (latest.probe(policy_.Path(s))) i_ = i;
     }
-    if (!latest.trivial()) latest_ = std::make_shared<latest_file>(std::move(latest));
+    if (latest.trivial()) return;
+    if (policy_.options().mmap) latest.recover(size_);
+    latest_ = std::make_shared<latest_file>(std::move(latest));
+
+    // left uncompressed by the previous run
+    for (int i = 0; i < n; ++i) {
+        if (i != i_) policy_.Compress(witness_[i]);
+    }
 }
 
 std::shared_ptr<File> SizeRotate::Next() {
+    SLOG_PROBE(rotate_start, i_);
     written_ = 0;
-    if (i_ == policy_.max_files()) i_ = 0;
-    unlink(policy_.slink().c_str());
-    auto& f = witness_[i_];
-    symlink(f.substr(f.rfind('/') + 1).c_str(), policy_.slink().c_str());
-
-    bool append = false;
-    if (latest_) {
-        if (latest_->size() < size_) {
-            append = true;
-            written_ = latest_->size();
+    const int n = policy_.max_files();
+    // unless the retired segment is reused at once, or prepared over with two files
+    const int reuse = policy_.options().prepare ? 2 : 1;
+    if (auto c = current_.lock(); c && i_ > 0 && n > reuse) {
+        policy_.Retire(*c, witness_[i_ - 1]);
+    }
+    if (i_ == n) i_ = 0;
+    auto f = policy_.Take(i_, buf_, size_);
+    if (!f) {
+        unlink(policy_.slink().c_str());
+        auto& p = witness_[i_];
+        symlink(p.substr(p.rfind('/') + 1).c_str(), policy_.slink().c_str());
+
+        bool append = false;
+        if (latest_) {
+            if (latest_->size() < size_) {
+                append = true;
+                written_ = latest_->size();
+            }
+            latest_.reset();
         }
-        latest_.reset();
+        // a new inode, the compressor may still read the old one
+        if (!append && policy_.options().compress) policy_.Remove(p);
+        f = policy_.Open(p, buf_, append, size_);
     }
-    return File::of(witness_[i_++].c_str(), Buf::of(buf_), append);
+    ++i_;
+    current_ = f;
+
+    // with a single file the next segment is this one
+    if (n > 1) {
+        auto& p = witness_[i_ % n];
+        policy_.Prepare(i_ % n, p, p, p.substr(p.rfind('/') + 1), false, size_);
+    }
+    SLOG_PROBE(rotate_end, i_ - 1);
+    return f;
 }
 
 bool SizeRotate::Spill(Metadata metadata) {
@@ -275,7 +566,7 @@ TimeRotate::TimeRotate(RotatePolicy policy, int64_t span)
                        &tm.tm_hour);
         if (n != 4) {
             // remove unrelated files
-            unlink(policy_.Path(s).c_str());
+            policy_.Remove(policy_.Path(s));
             continue;
         }
         tm.tm_year -= 1900;
@@ -283,7 +574,7 @@ TimeRotate::TimeRotate(RotatePolicy policy, int64_t span)
         auto t = mktime(&tm);
         if (t <= earliest_time) {
             // remove early files
-            unlink(policy_.Path(s).c_str());
+            policy_.Remove(policy_.Path(s));
             continue;
         }
         rest.push_back({i - 1, (int)t});
@@ -303,12 +594,15 @@ TimeRotate::TimeRotate(RotatePolicy policy, int64_t span)
         if (++i == policy_.max_files()) break;
         witness_.push_front(policy_.Path(v[it->first]));
     }
+
+    // left uncompressed by the previous run
+    for (auto& f : witness_) policy_.Compress(f);
 }
 
-std::string TimeRotate::new_file() const {
+std::string TimeRotate::new_file(int64_t t) const {
     char buf[16];
     tm tm{};
-    localtime_r(&current_time_, &tm);
+    localtime_r(&t, &tm);
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wformat-truncation"
     snprintf(buf, sizeof(buf), "%04d-%02d-%02d_%02d", tm.tm_year + 1900, tm.tm_mon + 1,
@@ -318,23 +612,44 @@ std::string TimeRotate::new_file() const {
 }
 
 std::shared_ptr<File> TimeRotate::Next() {
+    SLOG_PROBE(rotate_start, current_time_);
+    if (auto c = current_.lock(); c && !witness_.empty()) {
+        policy_.Retire(*c, witness_.back());
+    }
+    auto f = policy_.Take(current_time_, buf_);
     if ((int)witness_.size() >= policy_.max_files()) {
         auto t = std::move(witness_.front());
         witness_.pop_front();
-        unlink(t.c_str());
+        // the preparer removed it already
+        if (!f) policy_.Remove(t);
     }
 
-    witness_.push_back(new_file());
-
-    unlink(policy_.slink().c_str());
-    symlink(witness_.back().c_str(), policy_.slink().c_str());
+    if (f) {
+        witness_.push_back(std::move(next_));
+    } else {
+        witness_.push_back(new_file(current_time_));
+        unlink(policy_.slink().c_str());
+        symlink(witness_.back().c_str(), policy_.slink().c_str());
+        f = policy_.Open(witness_.back(), buf_, true);
+    }
 
-    return File::of(witness_.back().c_str(), Buf::of(buf_), true);
+    const auto next = current_time_ + span_;
+    if (policy_.options().prepare) {
+        next_ = new_file(next);
+        const bool full = (int)witness_.size() >= policy_.max_files();
+        policy_.Prepare(next, next_, full ? witness_.front() : ""s, next_, true);
+    }
+    current_ = f;
+    SLOG_PROBE(rotate_end, current_time_);
+    return f;
 }
 
 bool TimeRotate::Spill(Metadata metadata) {
-    if (metadata.seconds <= current_time_ + span_) return false;
-    current_time_ += span_;
+    // an unknown event time goes by the clock
+    const auto t = metadata.seconds ? metadata.seconds : current_seconds();
+    if (t < current_time_ + span_) return false;
+    // skips the spans nothing was logged in
+    current_time_ += (t - current_time_) / span_ * span_;
     return true;
 }
 
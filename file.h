@@ -1,10 +1,16 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <functional>
 #include <list>
 #include <memory>
 #include <string>
 #include <vector>
 #include "config.h"
+#include "metrics.h"
+#include "probe.h"
+#include "str.h"
 
 namespace slog {
 
@@ -20,67 +26,260 @@ class trampoline : public T {
 class Buf {
     char* a_;
     int i_;
-    const int n_;
+    int n_;
     Buf(char* a, int n);
 
    public:
     bool Write(std::string_view s);
     std::string_view Rewind();
 
+    // in-place writes go to [Tail(), Tail() + Room()) and are published by Commit
+    char* Tail() const {
+        return a_ + i_;
+    }
+    int Room() const {
+        return n_ - i_;
+    }
+    void Commit(int n) {
+        i_ += n;
+    }
+
     static Buf of(char* a, int n);
     static Buf of(std::string& s);
 };
 
+// formats at the tail of `b`, returns false and leaves `b` untouched if it is full
+template <typename FMT, typename... ARGS>
+bool format_to(Buf& b, size_t& n, FMT fmt, const ARGS&... args) {
+    n = internal::format_to(b.Tail(), b.Room(), fmt, args...);
+    if (n > (size_t)b.Room()) return false;
+    b.Commit(n);
+    return true;
+}
+
+// what Flush and closing a file do beyond handing the buffer to the kernel
+enum class Durability {
+    none,       // nothing, writeback is left to the kernel
+    writeback,  // Flush starts writeback of the new data, never waits for the disk
+    rotate,     // fdatasync only when the file is closed
+    flush,      // fdatasync on every Flush
+};
+
 class File {
+    friend class trampoline<File>;
+
+   protected:
     const int fd_;
     Buf buf_;
+    Durability durability_;
+    bool fadvise_;
+    bool closed_;
+    int64_t first_;  // event seconds of the buffered data, 0 if unknown
+    int64_t last_;
+    std::function<void()> on_close_;
+    uint64_t synced_;    // end of the range handed to writeback
+    uint64_t advised_;   // end of the range dropped from the page cache
+    uint64_t retry_;     // start of the last range dropped, some pages may have stayed
+    Metrics* metrics_;   // nullptr if not counted
     File(int fd, Buf buf);
-    friend class trampoline<File>;
+
+    // the buffer is handed over, `n` bytes did not fit
+    void full(size_t n) {
+        SLOG_PROBE(buffer_full, fd_, n);
+        if (metrics_) metrics_->full.Add(1);
+    }
+
+    // hands the buffered bytes over to the kernel
+    virtual bool Drain();
+    // writes a chunk larger than the whole buffer, after Drain
+    virtual bool Put(std::string_view s);
+    // writes what Drain keeps buffered, before a sync or close
+    virtual bool DrainTail() {
+        return true;
+    }
+    virtual bool Datasync();
+    // starts writeback of the data written since the last call
+    virtual bool Writeback();
+    // end of the data handed to the kernel
+    virtual int64_t Tell();
+    // drops the cached pages of [advised_, end) without waiting for their writeback
+    virtual void Advise(uint64_t end);
+    // drains and applies the durability mode once, the most derived destructor calls it
+    void Close();
 
    public:
-    ~File();
+    virtual ~File();
 
     bool Write(std::string_view s);
     bool Flush();
+    // the event time of what was just written
+    void Stamp(int64_t seconds) {
+        if (!first_) first_ = seconds;
+        last_ = seconds;
+    }
+    // moves up to `n` bytes from pipe `fd` to the file without a user-space copy
+    virtual ssize_t Splice(int fd, size_t n);
+    // bytes that go in without waiting for the disk
+    virtual size_t Headroom() {
+        return SIZE_MAX;
+    }
 
+    // formats straight into the buffer, returns the formatted size
+    template <typename FMT, typename... ARGS>
+    size_t Format(FMT fmt, const ARGS&... args) {
+        size_t n;
+        if (format_to(buf_, n, fmt, args...)) return n;
+        full(n);
+        if (Drain() && format_to(buf_, n, fmt, args...)) return n;
+        // larger than the whole buffer
+        Write(internal::format(fmt, args...));
+        return n;
+    }
+    // room for `n` bytes written in place and published by Commit, nullptr if they do
+    // not fit the buffer
+    char* Reserve(size_t n) {
+        if ((size_t)buf_.Room() >= n) return buf_.Tail();
+        full(n);
+        if (Drain() && (size_t)buf_.Room() >= n) return buf_.Tail();
+        return nullptr;
+    }
+    void Commit(size_t n) {
+        buf_.Commit(n);
+    }
+
+    // `fadvise` drops written data from the page cache once it is on disk
+    void set_durability(Durability d, bool fadvise);
+    // runs after the fd is closed
+    void set_on_close(std::function<void()> f) {
+        on_close_ = std::move(f);
+    }
+    // counts the writes and syncs from now on in `m`, which outlives the file
+    void set_metrics(Metrics* m) {
+        metrics_ = m;
+    }
+
+    // `read` also opens it for reading
+    static int Open(const char* path, bool append, bool read = false);
     static std::shared_ptr<File> of(const char* path, Buf buf, bool append);
     static std::shared_ptr<File> of(int fd, Buf buf);
+    // the end of data in the first `end` bytes of `fd`, without the zero tail a crash
+    // leaves in a preallocated or padded file; binary logs end at their last record
+    static uint64_t DataEnd(int fd, uint64_t end);
 };
 
+class Compressor;
+class Flusher;
+class Preparer;
+
 struct Metadata {
     uint64_t size;
     int64_t seconds;
 };
 
+// what a redirected fd or a queue does while its file cannot take more data without
+// waiting for the disk
+enum class Overload {
+    block,        // wait, the producer blocks once the pipe or the ring is full
+    drop_newest,  // hold up to the spill size, then drop what arrives
+    drop_oldest,  // hold up to the spill size, dropping the oldest held data; a
+                  // queue cannot and drops what arrives, as drop_newest
+    spill,        // hold up to the spill size, then wait
+};
+
+// data dropped by the overload policy
+struct Loss {
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> lines{0};  // newlines among the bytes
+
+    void add(std::string_view s) {
+        bytes.fetch_add(s.size(), std::memory_order_relaxed);
+        lines.fetch_add(std::count(s.begin(), s.end(), '\n'), std::memory_order_relaxed);
+    }
+};
+
 class RotatePolicy {
+   public:
+    struct Options {
+        int n{6};
+        int buf_size{1024 * 1024};
+        int pipe_size{0};
+        bool splice{false};
+        int max_line{0};
+        int line_timeout{1};
+        int io_uring{0};
+        int flush_bufs{-1};  // until Build picks it
+        bool o_direct{false};
+        bool mmap{false};
+        bool prepare{false};
+        int frames{0};
+        int compress{0};
+        int compress_cpu{25};
+        Durability durability{Durability::flush};
+        bool fadvise{false};
+        std::string prefix;
+        Overload overload{Overload::block};
+        int spill{1024 * 1024};
+        int loss_marker{10};
+    };
+
+   private:
     std::string base_;
     std::string name_;
     std::string ext_;
     std::string slink_;
-    int n_;
-    int buf_size_;
-    RotatePolicy(std::string base, std::string name, std::string ext, int n,
-                 int buf_size);
+    Options o_;
+    mutable std::shared_ptr<Flusher> flusher_;
+    mutable std::shared_ptr<Preparer> preparer_;
+    mutable std::shared_ptr<Compressor> compressor_;
+    std::shared_ptr<Loss> loss_;
+    RotatePolicy(std::string base, std::string name, std::string ext, Options o);
+
+    std::shared_ptr<File> Wrap(int fd, std::string& buf, uint64_t size) const;
+    std::shared_ptr<Compressor>& compressor() const;
 
    public:
     std::vector<std::string> Probe() const;
     std::string Path(std::string_view tag) const;
+    // opens `path` with the configured backend, `size` is the segment size if known
+    std::shared_ptr<File> Open(const std::string& path, std::string& buf, bool append,
+                               uint64_t size = 0) const;
+    // opens the segment `key` on a background thread with its symlink ready, after
+    // unlinking `drop`; a no-op unless prepare is set
+    void Prepare(int64_t key, const std::string& path, const std::string& drop,
+                 std::string target, bool append, uint64_t size = 0) const;
+    // the segment prepared for `key` with the symlink moved into place, nullptr if none
+    std::shared_ptr<File> Take(int64_t key, std::string& buf, uint64_t size = 0) const;
+    // removes segment `path` and its compressed copy
+    void Remove(const std::string& path) const;
+    // compresses segment `path` in the background, a no-op unless compress is set
+    void Compress(std::string path) const;
+    // compresses segment `path` once `f` is closed
+    void Retire(File& f, std::string path) const;
     auto max_files() const {
-        return n_;
+        return o_.n;
     }
     auto buf_size() const {
-        return buf_size_;
+        return o_.buf_size;
     }
     auto& slink() const {
         return slink_;
     }
+    auto& options() const {
+        return o_;
+    }
+    // time spent blocked on the background flusher, in nanoseconds
+    uint64_t blocked_ns() const;
+    // dropped by the overload policy, across the loggers of the policy
+    Loss& loss() const {
+        return *loss_;
+    }
 
     class Builder {
+       protected:
         std::string base_{"."s};
         std::string name_;
         std::string ext_{"log"s};
-        int n_{6};
-        int buf_size_{1024 * 1024};
+        Options o_;
 
        public:
         auto& set_base(std::string base) {
@@ -96,14 +295,118 @@ class RotatePolicy {
             return *this;
         }
         auto& set_num_files(int n) {
-            n_ = n;
+            o_.n = n;
             return *this;
         }
         auto& set_buf_size(int buf_size) {
-            buf_size_ = buf_size;
+            o_.buf_size = buf_size;
             return *this;
         }
         Builder& set_buf_size(Bytes bytes);
+        // capacity of the redirect pipe (F_SETPIPE_SZ), 0 keeps the system default
+        auto& set_pipe_size(int pipe_size) {
+            o_.pipe_size = pipe_size;
+            return *this;
+        }
+        Builder& set_pipe_size(Bytes bytes);
+        // drain redirected fds with splice() instead of read() and a copy
+        auto& set_splice(bool splice) {
+            o_.splice = splice;
+            return *this;
+        }
+        // hand only whole lines of redirected fds to the logger, 0 disables framing;
+        // a partial line is cut at `max_line` bytes, or after `line_timeout` idle seconds
+        auto& set_max_line(int max_line) {
+            o_.max_line = max_line;
+            return *this;
+        }
+        Builder& set_max_line(Bytes bytes);
+        auto& set_line_timeout(int seconds) {
+            o_.line_timeout = seconds;
+            return *this;
+        }
+        Builder& set_line_timeout(Seconds seconds);
+        // file backends: of those set, a file takes the first that works in the order
+        // frames, mmap, O_DIRECT, io_uring, flusher, and write() if none does
+        //
+        // write through io_uring with `depth` buffers in flight, 0 disables; skipped if
+        // the kernel lacks io_uring
+        auto& set_io_uring(int depth) {
+            o_.io_uring = depth;
+            return *this;
+        }
+        // hand full buffers to a background flusher thread, with `n` buffers in total,
+        // at least 2 since rotation opens the next file before the last lets go of its
+        // buffer; 0 writes on the caller's thread. Unset, see set_overload
+        auto& set_flusher(int n) {
+            o_.flush_bufs = n;
+            return *this;
+        }
+        // write with O_DIRECT, bypassing the page cache; skipped if the file system
+        // lacks it
+        auto& set_o_direct(bool o_direct) {
+            o_.o_direct = o_direct;
+            return *this;
+        }
+        // preallocate and map each segment, writes become a memcpy; SizeRotate only,
+        // skipped for a file already the segment size or that cannot be mapped
+        auto& set_mmap(bool mmap) {
+            o_.mmap = mmap;
+            return *this;
+        }
+        // open the next segment on a background thread ahead of rotation; the oldest
+        // segment is removed at that point instead of on rotation
+        auto& set_prepare(bool prepare) {
+            o_.prepare = prepare;
+            return *this;
+        }
+        // write each flushed buffer as an independently decodable deflate frame at
+        // zlib `level` -1 to 9, 0 disables, Build disables any other; segment sizes
+        // count uncompressed bytes
+        auto& set_frames(int level) {
+            o_.frames = level;
+            return *this;
+        }
+        // gzip rotated segments in the background at zlib `level` -1 to 9, 0 disables,
+        // Build disables any other; retention counts them as segments
+        auto& set_compress(int level) {
+            o_.compress = level;
+            return *this;
+        }
+        // cap on the compressor thread, in percent of one core
+        auto& set_compress_cpu(int percent) {
+            o_.compress_cpu = percent;
+            return *this;
+        }
+        auto& set_durability(Durability d) {
+            o_.durability = d;
+            return *this;
+        }
+        // posix_fadvise(DONTNEED) written ranges so logs do not evict hot page cache
+        auto& set_fadvise(bool fadvise) {
+            o_.fadvise = fadvise;
+            return *this;
+        }
+        // prefix each line written by Logger::Log, see internal::prefixer for the
+        // spec, e.g. "{local.ms} {pid} [{fd}] "; redirected fds are then not spliced
+        auto& set_prefix(std::string spec) {
+            o_.prefix = std::move(spec);
+            return *this;
+        }
+        // anything but block holds up to `spill` bytes of a redirected fd while the
+        // file is stalled; the synchronous backends never stall, so unless set_flusher
+        // or set_io_uring is, the writes move to a flusher with 4 buffers
+        auto& set_overload(Overload overload, int spill) {
+            o_.overload = overload;
+            o_.spill = spill;
+            return *this;
+        }
+        Builder& set_overload(Overload overload, Bytes spill);
+        // seconds between the lines that report dropped data in the log, at most
+        auto& set_loss_marker(int seconds) {
+            o_.loss_marker = seconds;
+            return *this;
+        }
         RotatePolicy Build();
     };
 };
@@ -118,12 +421,16 @@ class SizeRotate {
     std::vector<std::string> witness_;
     std::string buf_;
     std::shared_ptr<latest_file> latest_;
+    std::weak_ptr<File> current_;
     SizeRotate(RotatePolicy policy, uint64_t size);
     friend class trampoline<SizeRotate>;
 
    public:
     std::shared_ptr<File> Next();
     bool Spill(Metadata);
+    auto& policy() const {
+        return policy_;
+    }
 
     class Builder : public RotatePolicy::Builder {
         uint64_t size_;
@@ -144,14 +451,19 @@ class TimeRotate {
     int64_t current_time_;
     std::list<std::string> witness_;
     std::string buf_;
+    std::string next_;  // prepared path
+    std::weak_ptr<File> current_;
     TimeRotate(RotatePolicy policy, int64_t span);
     friend class trampoline<TimeRotate>;
 
-    std::string new_file() const;
+    std::string new_file(int64_t t) const;
 
    public:
     std::shared_ptr<File> Next();
     bool Spill(Metadata);
+    auto& policy() const {
+        return policy_;
+    }
 
     class Builder : public RotatePolicy::Builder {
         int64_t span_;
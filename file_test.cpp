@@ -0,0 +1,231 @@
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef SLOG_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include "compress.h"
+#include "frame.h"
+#include "log.h"
+#include "str.h"
+#include "test.h"
+
+// lines of segment `path`, or of its compressed copy
+static std::vector<std::string> segment(const std::string& path) {
+    std::string s;
+#ifdef SLOG_HAVE_ZLIB
+    auto z = gzopen((access(path.c_str(), F_OK) == 0 ? path : path + ".gz").c_str(), "rb");
+    char buf[4096];
+    for (int n; z && (n = gzread(z, buf, sizeof(buf))) > 0;) s.append(buf, n);
+    if (z) gzclose(z);
+#else
+    std::ifstream f{path};
+    s.assign(std::istreambuf_iterator<char>{f}, {});
+#endif
+    std::vector<std::string> v;
+    std::istringstream in{s};
+    for (std::string line; std::getline(in, line);) v.push_back(line);
+    return v;
+}
+
+int main(int argc, char* argv[]) {
+    using namespace slog;
+    const int n = argc < 2 ? 200000 : atoi(argv[1]);
+    const std::pair<std::string, Durability> modes[] = {
+        {"none", Durability::none},
+        {"flush", Durability::flush},
+        {"writeback", Durability::writeback},
+        {"rotate", Durability::rotate},
+    };
+    for (auto backend : {"plain"s, "uring"s, "flusher"s, "direct"s, "mmap"s}) {
+        for (auto& [mode, durability] : modes) {
+            const auto name = backend + '_' + mode;
+            const auto path = "/tmp/file_test_" + name + ".0.log";
+            unlink(path.c_str());
+            // the second run resumes the file
+            for (auto [from, to] : {std::pair{0, n / 2}, std::pair{n / 2, n}}) {
+                SizeRotate::Builder builder;
+                builder.set_size("1g"_b)
+                    .set_name("file_test_"s + name)
+                    .set_base("/tmp"s)
+                    .set_num_files(2)
+                    .set_buf_size("4k"_b)
+                    .set_io_uring(backend == "uring" ? 4 : 0)
+                    .set_flusher(backend == "flusher" ? 2 : 0)
+                    .set_o_direct(backend == "direct")
+                    .set_mmap(backend == "mmap")
+                    .set_durability(durability)
+                    .set_fadvise(durability == Durability::writeback);
+                auto logger = Logger<SizeRotate>::of(builder.Build());
+                std::string big(10000, 'x');
+                for (int i = from; i < to; ++i) {
+                    logger->Logf(
+                        "#{} this is a test: abcd-efg-hi-jk-lmn-opq-rst-uvw-xyz\n"_fmt, i);
+                    if (i % 1000 == 0) logger->Flush();
+                    // larger than the buffer
+                    if (i % 10000 == 0) logger->Log(big + '\n', {});
+                }
+            }
+            std::ifstream in{path};
+            std::string line;
+            int i = 0;
+            while (std::getline(in, line)) {
+                if (line[0] == 'x') continue;
+                EXPECT_EQ(line, internal::format(
+                                    "#{} this is a test: abcd-efg-hi-jk-lmn-opq-rst-uvw-xyz"_fmt,
+                                    i));
+                ++i;
+            }
+            EXPECT_EQ(i, n);
+        }
+    }
+
+    // rotation: inline, with the next segment opened ahead of time, compressed, through
+    // a flusher with as few buffers as asked for
+    for (auto mode : {"inline"s, "prepared"s, "compressed"s, "flusher"s}) {
+        if (mode == "compressed" && !Compressor::available) continue;
+        const auto name = "file_test_rotate_" + mode;
+        for (int i = 0; i < 3; ++i) {
+            const auto p = internal::format("/tmp/{}.{}.log"sv, name, i);
+            unlink(p.c_str());
+            unlink((p + ".gz").c_str());
+        }
+        const int m = 30000;
+        {
+            SizeRotate::Builder builder;
+            builder.set_size("64k"_b)
+                .set_name(name)
+                .set_base("/tmp"s)
+                .set_num_files(3)
+                .set_buf_size("4k"_b)
+                .set_prepare(mode == "prepared")
+                .set_flusher(mode == "flusher" ? 1 : 0)
+                .set_compress(mode == "compressed" ? 6 : 0)
+                .set_compress_cpu(100);
+            auto logger = Logger<SizeRotate>::of(builder.Build());
+            for (int i = 0; i < m; ++i) logger->Logf("#{} rotate\n"_fmt, i);
+            // the compressor drops pending segments on shutdown
+            auto done = [&] {
+                for (int k : {1, 2}) {
+                    const auto p = internal::format("/tmp/{}.{}.log"sv, name, k);
+                    if (access(p.c_str(), F_OK) == 0) return false;
+                }
+                return true;
+            };
+            for (int i = 0; mode == "compressed" && !done() && i < 1000; ++i) usleep(1000);
+        }
+        // the segments left hold the newest lines without a gap
+        std::vector<int> v;
+        int compressed = 0;
+        for (int k = 0; k < 3; ++k) {
+            const auto p = internal::format("/tmp/{}.{}.log"sv, name, k);
+            compressed += access(p.c_str(), F_OK) != 0;
+            for (auto& line : segment(p)) v.push_back(atoi(&line[1]));
+        }
+        std::sort(v.begin(), v.end());
+        EXPECT_TRUE(v.size() > 5000);
+        for (int i = 0; i < (int)v.size(); ++i) EXPECT_EQ(v[i], m - (int)v.size() + i);
+        EXPECT_EQ(compressed, mode == "compressed" ? 2 : mode == "prepared");
+        std::ifstream link{"/tmp/" + name + ".log"};
+        std::string last;
+        for (std::string line; std::getline(link, line);) last = line;
+        EXPECT_EQ(last, internal::format("#{} rotate"sv, m - 1));
+    }
+
+    // a level zlib rejects leaves segments as they are
+    if (Compressor::available) {
+        RotatePolicy::Builder b;
+        EXPECT_EQ(b.set_compress(10).Build().options().compress, 0);
+        const auto p = "/tmp/file_test_level.log"s;
+        unlink((p + ".gz").c_str());
+        {
+            std::ofstream out{p};
+            out << "abc\n";
+        }
+        struct stat st {};
+        stat(p.c_str(), &st);
+        {
+            Compressor c{10, 100};
+            c.Submit(p, st);
+            usleep(100000);
+        }
+        EXPECT_EQ(segment(p), std::vector<std::string>{"abc"});
+        EXPECT_TRUE(access((p + ".gz").c_str(), F_OK) != 0);
+        unlink(p.c_str());
+    }
+
+    // deflate frames, resumed past a torn frame
+    if (Compressor::available) {
+        const auto path = "/tmp/file_test_frames.0.log"s;
+        unlink(path.c_str());
+        const int m = 100000;
+        for (auto [from, to] : {std::pair{0, m / 2}, std::pair{m / 2, m}}) {
+            {
+                SizeRotate::Builder builder;
+                builder.set_size("1g"_b)
+                    .set_name("file_test_frames"s)
+                    .set_base("/tmp"s)
+                    .set_buf_size("64k"_b)
+                    .set_frames(1);
+                auto logger = Logger<SizeRotate>::of(builder.Build());
+                for (int i = from; i < to; ++i) {
+                    const auto line = internal::format("#{} this is a test: abcd-efg\n"sv, i);
+                    logger->Log(line, {1000 + i / 1000});
+                }
+            }
+            std::ofstream{path, std::ios::app} << "torn";
+        }
+        int fd = open(path.c_str(), O_RDONLY);
+        frame_header h{};
+        std::string raw, s;
+        int64_t last = 0;
+        while (read_frame(fd, h, &s)) {
+            EXPECT_TRUE(last <= h.first && h.first <= h.last);
+            last = h.last;
+            raw += s;
+        }
+        const auto size = lseek(fd, 0, SEEK_END);
+        EXPECT_TRUE(size * 5 < (off_t)raw.size());
+        std::istringstream in{raw};
+        int i = 0;
+        for (std::string line; std::getline(in, line); ++i) {
+            EXPECT_EQ(line, internal::format("#{} this is a test: abcd-efg"sv, i));
+        }
+        EXPECT_EQ(i, m);
+
+        // jump to the frame holding second 1042 by its header
+        lseek(fd, 0, SEEK_SET);
+        while (read_frame(fd, h, nullptr) && h.last < 1042) {
+        }
+        lseek(fd, -(off_t)(sizeof(h) + h.size), SEEK_CUR);
+        EXPECT_TRUE(read_frame(fd, h, &s) && h.first <= 1042);
+        EXPECT_TRUE(s.find("#42000 ") != std::string::npos);
+        close(fd);
+
+        // a level zlib rejects writes plain segments
+        RotatePolicy::Builder b;
+        EXPECT_EQ(b.set_frames(10).Build().options().frames, 0);
+        fd = open(path.c_str(), O_WRONLY | O_TRUNC);
+        EXPECT_TRUE(FrameFile::of(fd, 4096, 10) == nullptr);
+        close(fd);
+    }
+
+    // a mapped segment left preallocated by a crash
+    const auto path = "/tmp/file_test_crash.0.log"s;
+    {
+        std::ofstream out{path};
+        out << "abc\n";
+    }
+    EXPECT_EQ(truncate(path.c_str(), 1 << 20), 0);
+    {
+        SizeRotate::Builder builder;
+        builder.set_size("1m"_b).set_name("file_test_crash"s).set_base("/tmp"s).set_mmap(true);
+        auto logger = Logger<SizeRotate>::of(builder.Build());
+        logger->Log("def\n"sv, {});
+    }
+    std::ifstream in{path};
+    EXPECT_EQ(std::string(std::istreambuf_iterator<char>{in}, {}), "abc\ndef\n"s);
+}
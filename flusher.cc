@@ -0,0 +1,165 @@
+#include "flusher.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+
+namespace slog {
+
+Flusher::Flusher(int size, int n)
+    : size_{size}, busy_{false}, stop_{false}, blocked_{0}, errors_{0} {
+    for (int i = 0; i < n; ++i) {
+        bufs_.emplace_back(new char[size]);
+        free_.push_back(i);
+    }
+    worker_ = std::thread{[this] { run(); }};
+}
+
+Flusher::~Flusher() {
+    {
+        std::scoped_lock lock{m_};
+        stop_ = true;
+    }
+    work_.notify_one();
+    worker_.join();
+}
+
+void Flusher::run() {
+    std::unique_lock lock{m_};
+    for (;;) {
+        work_.wait(lock, [this] { return stop_ || !jobs_.empty(); });
+        if (jobs_.empty()) return;
+        auto j = std::move(jobs_.front());
+        jobs_.pop_front();
+        busy_ = true;
+        lock.unlock();
+
+        bool ok = true;
+        if (j.buf == -1) {
+            ok = j.fn();
+        } else {
+            for (auto p = bufs_[j.buf].get(), e = p + j.n; p != e && ok;) {
+                auto n = internal::counted_write(j.metrics,
+                                                 [&] { return write(j.fd, p, e - p); });
+                if (n > 0) {
+                    p += n;
+                } else if (n == -1 && errno != EINTR) {
+                    ok = false;
+                }
+            }
+        }
+        if (!ok) errors_.fetch_add(1, std::memory_order_relaxed);
+
+        lock.lock();
+        busy_ = false;
+        if (j.buf != -1) free_.push_back(j.buf);
+        done_.notify_all();
+    }
+}
+
+template <typename F>
+static void timed(std::atomic<uint64_t>& total, F&& f) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    auto d = std::chrono::steady_clock::now() - start;
+    total.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count(),
+                    std::memory_order_relaxed);
+}
+
+char* Flusher::Acquire(int& i) {
+    std::unique_lock lock{m_};
+    if (free_.empty()) {
+        timed(blocked_, [&] { done_.wait(lock, [this] { return !free_.empty(); }); });
+    }
+    i = free_.back();
+    free_.pop_back();
+    return bufs_[i].get();
+}
+
+void Flusher::Release(int i) {
+    std::scoped_lock lock{m_};
+    free_.push_back(i);
+    done_.notify_all();
+}
+
+void Flusher::Submit(int fd, int i, size_t n, Metrics* m) {
+    {
+        std::scoped_lock lock{m_};
+        jobs_.push_back({fd, i, n, m, nullptr});
+    }
+    work_.notify_one();
+}
+
+void Flusher::Run(std::function<bool()> fn) {
+    {
+        std::scoped_lock lock{m_};
+        jobs_.push_back({-1, -1, 0, nullptr, std::move(fn)});
+    }
+    work_.notify_one();
+}
+
+void Flusher::Wait() {
+    std::unique_lock lock{m_};
+    if (jobs_.empty() && !busy_) return;
+    timed(blocked_,
+          [&] { done_.wait(lock, [this] { return jobs_.empty() && !busy_; }); });
+}
+
+bool Flusher::Exhausted() {
+    std::scoped_lock lock{m_};
+    return free_.empty();
+}
+
+AsyncFile::AsyncFile(int fd, std::shared_ptr<Flusher> flusher)
+    : File{fd, Buf::of(nullptr, 0)}, flusher_{std::move(flusher)} {
+    buf_ = Buf::of(flusher_->Acquire(cur_), flusher_->size());
+}
+
+AsyncFile::~AsyncFile() {
+    Close();
+    // the fd is closed by the base class
+    flusher_->Wait();
+    flusher_->Release(cur_);
+    buf_ = Buf::of(nullptr, 0);
+}
+
+bool AsyncFile::Drain() {
+    auto r = buf_.Rewind();
+    if (r.empty()) return true;
+    flusher_->Submit(fd_, cur_, r.size(), metrics_);
+    buf_ = Buf::of(flusher_->Acquire(cur_), flusher_->size());
+    return true;
+}
+
+bool AsyncFile::Put(std::string_view s) {
+    // through the buffers, in order with the writes in flight
+    for (;;) {
+        const auto n = std::min(s.size(), (size_t)buf_.Room());
+        buf_.Write(s.substr(0, n));
+        s.remove_prefix(n);
+        if (s.empty()) return true;
+        Drain();
+    }
+}
+
+bool AsyncFile::Datasync() {
+    flusher_->Run([this] { return File::Datasync(); });
+    return true;
+}
+
+bool AsyncFile::Writeback() {
+    flusher_->Run([this] { return File::Writeback(); });
+    return true;
+}
+
+ssize_t AsyncFile::Splice(int fd, size_t n) {
+    Drain();
+    flusher_->Wait();
+    return splice(fd, nullptr, fd_, nullptr, n, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+}
+
+std::shared_ptr<File> AsyncFile::of(int fd, std::shared_ptr<Flusher> flusher) {
+    return std::make_shared<trampoline<AsyncFile>>(fd, std::move(flusher));
+}
+
+}  // namespace slog
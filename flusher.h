@@ -0,0 +1,99 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "file.h"
+
+namespace slog {
+
+/*
+   Background writer shared by the files of one rotate policy. It owns a set of
+   buffers: producers fill one while the others are written out, in order, by the
+   worker thread, and block only when every buffer is in flight.
+ */
+class Flusher {
+    struct job {
+        int fd;
+        int buf;  // -1 to run `fn` instead
+        size_t n;
+        Metrics* metrics;
+        std::function<bool()> fn;
+    };
+
+    const int size_;
+    std::vector<std::unique_ptr<char[]>> bufs_;
+    std::vector<int> free_;
+    std::deque<job> jobs_;
+    bool busy_;  // the worker holds a job
+    bool stop_;
+    std::mutex m_;
+    std::condition_variable work_;
+    std::condition_variable done_;
+    std::atomic<uint64_t> blocked_;  // nanoseconds
+    std::atomic<uint64_t> errors_;
+    std::thread worker_;
+
+    void run();
+
+   public:
+    Flusher(int size, int n);
+    ~Flusher();
+
+    auto size() const {
+        return size_;
+    }
+    // a clean buffer, blocks while all of them are in flight
+    char* Acquire(int& i);
+    void Release(int i);
+    // writes `n` bytes of buffer `i` to `fd`, counted in `m` unless null, then
+    // recycles the buffer
+    void Submit(int fd, int i, size_t n, Metrics* m);
+    // runs `fn` on the worker after the writes submitted so far
+    void Run(std::function<bool()> fn);
+    // blocks until every submitted job is done
+    void Wait();
+    // whether Acquire would block
+    bool Exhausted();
+
+    // time producers spent blocked on the flusher
+    uint64_t blocked_ns() const {
+        return blocked_.load(std::memory_order_relaxed);
+    }
+    uint64_t errors() const {
+        return errors_.load(std::memory_order_relaxed);
+    }
+};
+
+class AsyncFile : public File {
+    std::shared_ptr<Flusher> flusher_;
+    int cur_;
+
+    AsyncFile(int fd, std::shared_ptr<Flusher> flusher);
+    friend class trampoline<AsyncFile>;
+
+   protected:
+    bool Drain() override;
+    bool Put(std::string_view s) override;
+    // both are queued after the pending writes, neither waits
+    bool Datasync() override;
+    bool Writeback() override;
+
+   public:
+    ~AsyncFile() override;
+
+    size_t Headroom() override {
+        // what does not fit the buffer goes to a new one
+        return flusher_->Exhausted() ? buf_.Room() : flusher_->size();
+    }
+    ssize_t Splice(int fd, size_t n) override;
+
+    static std::shared_ptr<File> of(int fd, std::shared_ptr<Flusher> flusher);
+};
+
+}  // namespace slog
@@ -1,8 +1,78 @@
+#include <sstream>
+#include <thread>
+#include <vector>
 #include "str.h"
 #include "test.h"
 
+enum class color { red, green };
+enum class shape { circle };
+static std::ostream& operator<<(std::ostream& os, shape) {
+    return os << "circle"sv;
+}
+enum weekday { monday, tuesday };
+static std::ostream& operator<<(std::ostream& os, weekday d) {
+    return os << (d == monday ? "mon"sv : "tue"sv);
+}
+enum level { low, high };
+
+template <typename T>
+static std::string ostream_of(const T& t) {
+    std::ostringstream ss;
+    ss << t;
+    return ss.str();
+}
+
 int main() {
+    using namespace slog;
     using namespace slog::internal;
     EXPECT_EQ(format("{{"sv), "{"sv);
     EXPECT_EQ(format("this {} a test"sv, "is"sv), "this is a test"sv);
+
+    static_assert(decltype("{} + {} = {}"_fmt)::parsed.n_slots == 3);
+    EXPECT_EQ(format("{{"_fmt), "{"sv);
+    EXPECT_EQ(format("this {} a test"_fmt, "is"sv), "this is a test"sv);
+    EXPECT_EQ(format("{} + {} = {}}}"_fmt, 1, 2, 3), "1 + 2 = 3}"sv);
+    EXPECT_EQ(format("{} + {} = {}}}"_fmt, 1, 2, 3), format("{} + {} = {}}}"sv, 1, 2, 3));
+
+    char buf[8];
+    EXPECT_EQ(format_to(buf, sizeof(buf), "#{}: {}"_fmt, 42, "abc"), 8ul);
+    EXPECT_EQ(std::string_view(buf, 8), "#42: abc"sv);
+    EXPECT_EQ(format_to(buf, 4, "#{}: {}"sv, 42, "abc"s), 8ul);
+    EXPECT_EQ(std::string_view(buf, 4), "#42:"sv);
+    EXPECT_EQ(format(std::string(300, 'x') + "{}", 1), std::string(300, 'x') + "1");
+
+    // fast paths agree with std::ostream
+    const int i = -42;
+    const double d = 3.14159265;
+    EXPECT_EQ(format("{}"_fmt, i), ostream_of(i));
+    EXPECT_EQ(format("{}"_fmt, 18446744073709551615ul), ostream_of(18446744073709551615ul));
+    EXPECT_EQ(format("{}"_fmt, d), ostream_of(d));
+    EXPECT_EQ(format("{}"_fmt, 1e-7), ostream_of(1e-7));
+    EXPECT_EQ(format("{}"_fmt, 1.5f), ostream_of(1.5f));
+    EXPECT_EQ(format("{}"_fmt, true), ostream_of(true));
+    EXPECT_EQ(format("{}"_fmt, &i), ostream_of(&i));
+    EXPECT_EQ(format("{}"_fmt, (void*)nullptr), ostream_of((void*)nullptr));
+    EXPECT_EQ(format("{}"_fmt, (unsigned char)'a'), "a"sv);
+    EXPECT_EQ(format("{} {}"_fmt, color::green, shape::circle), "1 circle"sv);
+    EXPECT_EQ(format("{} {}"_fmt, tuesday, high), "tue 1"sv);
+
+    // runtime formats beyond the cache capacity get evicted, concurrently
+    const auto before = cache.snapshot();
+    std::vector<std::thread> threads;
+    std::atomic_int errors{};
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&, t] {
+            for (int i = 0; i < 4096; ++i) {
+                auto f = format("#{}-{}: {{}}"_fmt, t, i);
+                if (format(f, i) != format("#{}-{}: {}"_fmt, t, i, i)) ++errors;
+                if (format("{} runtime"sv, i) != format("{} runtime"_fmt, i)) ++errors;
+            }
+        });
+    }
+    for (auto& t : threads) t.join();
+    EXPECT_EQ(errors.load(), 0);
+    const auto after = cache.snapshot();
+    EXPECT_EQ(after.hits + after.misses - before.hits - before.misses, 2ul * 4 * 4096);
+    EXPECT_TRUE(after.hits - before.hits >= 4 * 4095);
+    EXPECT_TRUE(after.evictions > before.evictions);
 }
@@ -0,0 +1,151 @@
+#include "frame.h"
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#ifdef SLOG_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+namespace slog {
+
+#ifdef SLOG_HAVE_ZLIB
+
+struct FrameFile::stream {
+    z_stream z{};
+    const bool ok;
+
+    explicit stream(int level)
+        : ok{deflateInit2(&z, level, Z_DEFLATED, -15 /* raw */, 8, Z_DEFAULT_STRATEGY) ==
+             Z_OK} {}
+    ~stream() {
+        if (ok) deflateEnd(&z);
+    }
+};
+
+static bool read_all(int fd, void* p, size_t n) {
+    for (auto a = (char*)p; n > 0;) {
+        auto r = read(fd, a, n);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return false;
+        a += r;
+        n -= r;
+    }
+    return true;
+}
+
+static bool write_all(int fd, const char* p, size_t n, Metrics* m) {
+    while (n > 0) {
+        auto r = internal::counted_write(m, [&] { return write(fd, p, n); });
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        p += r;
+        n -= r;
+    }
+    return true;
+}
+
+bool read_frame(int fd, frame_header& h, std::string* out) {
+    if (!read_all(fd, &h, sizeof(h)) || h.magic != frame_header::magic_v1) return false;
+    if (!out) {
+        // the payload must be complete
+        const auto at = lseek(fd, 0, SEEK_CUR);
+        const auto end = lseek(fd, 0, SEEK_END);
+        if (at < 0 || end - at < h.size) return false;
+        return lseek(fd, at + h.size, SEEK_SET) >= 0;
+    }
+    std::string in(h.size, '\0');
+    if (!read_all(fd, in.data(), in.size())) return false;
+    out->resize(h.raw);
+    z_stream z{};
+    inflateInit2(&z, -15);
+    z.next_in = (Bytef*)in.data();
+    z.avail_in = in.size();
+    z.next_out = (Bytef*)out->data();
+    z.avail_out = out->size();
+    const int r = inflate(&z, Z_FINISH);
+    inflateEnd(&z);
+    return r == Z_STREAM_END && z.avail_out == 0;
+}
+
+FrameFile::FrameFile(int fd, int size, std::unique_ptr<stream> z)
+    : File{fd, Buf::of(nullptr, 0)}, z_{std::move(z)} {
+    raw_.resize(size);
+    out_.resize(sizeof(frame_header) + deflateBound(&z_->z, size));
+    buf_ = Buf::of(raw_);
+}
+
+FrameFile::~FrameFile() {
+    Close();
+    buf_ = Buf::of(nullptr, 0);
+}
+
+bool FrameFile::Drain() {
+    auto r = buf_.Rewind();
+    if (r.empty()) return true;
+
+    auto& z = z_->z;
+    deflateReset(&z);
+    z.next_in = (Bytef*)r.data();
+    z.avail_in = r.size();
+    z.next_out = (Bytef*)out_.data() + sizeof(frame_header);
+    z.avail_out = out_.size() - sizeof(frame_header);
+    // the output has room for the whole frame
+    if (deflate(&z, Z_FINISH) != Z_STREAM_END) {
+        errno = EIO;
+        return false;
+    }
+
+    frame_header h{frame_header::magic_v1, (uint32_t)z.total_out, (uint32_t)r.size(), 0,
+                   first_, last_};
+    memcpy(out_.data(), &h, sizeof(h));
+    first_ = last_ = 0;
+    return write_all(fd_, out_.data(), sizeof(h) + z.total_out, metrics_);
+}
+
+bool FrameFile::Put(std::string_view s) {
+    // one frame per buffer
+    while (!s.empty()) {
+        const auto n = std::min<size_t>(buf_.Room(), s.size());
+        buf_.Write(s.substr(0, n));
+        s.remove_prefix(n);
+        if (!s.empty() && !Drain()) return false;
+    }
+    return true;
+}
+
+ssize_t FrameFile::Splice(int, size_t) {
+    errno = EINVAL;
+    return -1;
+}
+
+std::shared_ptr<File> FrameFile::of(int fd, int buf_size, int level) {
+    auto z = std::make_unique<stream>(level);
+    if (!z->ok) return nullptr;
+    // keep whole frames only
+    if (const auto end = lseek(fd, 0, SEEK_CUR); end > 0) {
+        off_t good = 0;
+        frame_header h{};
+        lseek(fd, 0, SEEK_SET);
+        while (good < end && read_frame(fd, h, nullptr)) good = lseek(fd, 0, SEEK_CUR);
+        if (good < end && ftruncate(fd, good) != 0) return nullptr;
+        lseek(fd, good, SEEK_SET);
+    }
+    return std::make_shared<trampoline<FrameFile>>(fd, buf_size, std::move(z));
+}
+
+#else
+
+bool read_frame(int, frame_header&, std::string*) {
+    return false;
+}
+
+std::shared_ptr<File> FrameFile::of(int, int, int) {
+    return nullptr;
+}
+
+#endif
+
+}  // namespace slog
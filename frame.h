@@ -0,0 +1,56 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include "file.h"
+
+namespace slog {
+
+/*
+   A framed segment is a sequence of frames, each a header followed by the raw deflate
+   stream of one flushed buffer. Frames decode independently, so a reader can hop from
+   header to header and inflate only the frames it needs. Fields are in native byte
+   order; the times bound the events in the frame.
+ */
+struct frame_header {
+    static constexpr uint32_t magic_v1 = 0x31464c53;  // "SLF1"
+
+    uint32_t magic;
+    uint32_t size;  // compressed bytes after the header
+    uint32_t raw;   // uncompressed bytes
+    uint32_t reserved;
+    int64_t first;  // seconds
+    int64_t last;
+};
+static_assert(sizeof(frame_header) == 32);
+
+// reads the frame at the offset of `fd`, inflating it into `out` unless null; false at
+// the end of the segment or at a torn frame
+bool read_frame(int fd, frame_header& h, std::string* out);
+
+class FrameFile : public File {
+    struct stream;
+
+    std::unique_ptr<stream> z_;
+    std::string raw_;
+    std::string out_;
+
+   protected:
+    bool Drain() override;
+    bool Put(std::string_view s) override;
+
+    FrameFile(int fd, int size, std::unique_ptr<stream> z);
+    friend class trampoline<FrameFile>;
+
+   public:
+    ~FrameFile() override;
+
+    // splice() would bypass the codec, fails with EINVAL so callers fall back to read()
+    ssize_t Splice(int fd, size_t n) override;
+
+    // nullptr without zlib or if it rejects `level`; a torn frame at the end of `fd`
+    // is cut off
+    static std::shared_ptr<File> of(int fd, int buf_size, int level);
+};
+
+}  // namespace slog
@@ -46,14 +46,17 @@ class dl_node {
            prev -> next
                 <-
          */
+        prev_ = next_ = this;
     }
 
     template <typename F>
     void iter(F&& f) {
         auto n = next_;
         while (n != this) {
+            // `f` may release the node
+            auto next = n->next_;
             if (f(n) != 0) break;
-            n = n->next_;
+            n = next;
         }
     }
 };
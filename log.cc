@@ -3,89 +3,524 @@
 #include <pthread.h>
 #include <sys/epoll.h>
 #include <sys/eventfd.h>
-#include <sys/time.h>
+#include <sys/syscall.h>
+#include <string.h>
 #include <unistd.h>
+#include <algorithm>
 #include <atomic>
+#include <cstdint>
+#include <deque>
 #include <mutex>
 #include "file.h"
 #include "iter.h"
 
 namespace slog {
 
-int64_t current_seconds();
+int pid = getpid();
+thread_local int tid = syscall(SYS_gettid);
 
 class event_handler : public slog::internal::dl_node {
    public:
+    // load accounting of the owning worker
+    uint64_t bytes = 0;   // handled so far
+    uint64_t mark = 0;    // `bytes` when the current rebalance period began
+    uint64_t recent = 0;  // handled in the last period
+    bool retrying = false;
+    bool paused = false;
     virtual ~event_handler() = default;
     virtual bool on_event() = 0;
     virtual void on_timeout(int now) = 0;
     virtual int fd() = 0;
+    // data held back while the file is stalled: 0 none, 1 some, 2 enough to stop
+    // reading the fd
+    virtual int backlog() {
+        return 0;
+    }
+    // writes held back data as far as the file allows
+    virtual void on_retry() {}
+};
+
+// keeps the partial last line of each read, so that only whole lines go out
+class framer {
+    static constexpr size_t chunk = 64 * 1024;
+    const size_t max_;
+    std::unique_ptr<char[]> buf_;
+    size_t len_;
+
+   public:
+    explicit framer(size_t max) : max_{max}, buf_{new char[max + chunk]}, len_{0} {}
+
+    // returns read()'s result
+    template <typename F>
+    ssize_t read(int fd, F&& f) {
+        auto p = buf_.get();
+        auto n = ::read(fd, p + len_, max_ + chunk - len_);
+        if (n <= 0) return n;
+
+        // the carry holds no newline, scan the new bytes only (memrchr is vectorized)
+        auto e = (const char*)memrchr(p + len_, '\n', n);
+        len_ += n;
+        size_t k = e ? e - p + 1 : 0;
+        // cut the partial line at max_
+        while (len_ - k >= max_) k += max_;
+        if (k == 0) return n;
+
+        f(std::string_view{p, k});
+        memmove(p, p + k, len_ - k);
+        len_ -= k;
+        return n;
+    }
+
+    template <typename F>
+    void flush(F&& f) {
+        if (len_ == 0) return;
+        f(std::string_view{buf_.get(), len_});
+        len_ = 0;
+    }
+};
+
+// reports dropped data in the log itself, once per `interval` seconds at most
+class loss_marker {
+    const int interval_;
+    int64_t marked_;
+    uint64_t bytes_;  // dropped since the last marker
+    uint64_t lines_;
+
+   public:
+    explicit loss_marker(int interval)
+        : interval_{interval}, marked_{0}, bytes_{0}, lines_{0} {}
+
+    void add(uint64_t bytes, uint64_t lines) {
+        bytes_ += bytes;
+        lines_ += lines;
+    }
+    // passes the marker to `write` if one is due, on a line of its own after the
+    // data written so far unless `bol`; `write` returns false to try again later
+    template <typename F>
+    void mark(int64_t now, bool bol, F&& write) {
+        if (!bytes_ || now < marked_ + interval_) return;
+        if (!write(internal::format("{}slog: dropped {} bytes, {} lines\n"_fmt,
+                                    bol ? "" : "\n", bytes_, lines_))) {
+            return;
+        }
+        marked_ = now;
+        bytes_ = lines_ = 0;
+    }
 };
 
 template <typename LOGGER>
 class proxy : public event_handler {
+    static constexpr size_t chunk = 64 * 1024;  // of held data
+
     int source_;
     int last_;
     std::shared_ptr<LOGGER> sink_;
+    size_t splice_;  // max bytes per splice(), 0 to read() and copy
+    int tag_;        // the redirected fd
+    std::unique_ptr<framer> framer_;
+    const Overload overload_;
+    const size_t spill_;
+    std::deque<std::string> held_;  // read while the file was stalled
+    size_t off_;                    // written of the first
+    size_t held_bytes_;
+    loss_marker marker_;
+    bool bol_;  // the last byte written is a newline
+
+    void write(std::string_view s) {
+        sink_->Log(s, {last_, tag_});
+        bol_ = s.back() == '\n';
+    }
+    // writes the whole lines of `s` the file takes without waiting, returns the bytes
+    // written; a line longer than the buffer goes in pieces
+    size_t offer(std::string_view s) {
+        if (s.empty()) return 0;
+        auto k = std::min(s.size(), sink_->Headroom());
+        if (k < s.size()) {
+            if (auto e = (const char*)memrchr(s.data(), '\n', k)) {
+                k = e - s.data() + 1;
+            } else {
+                auto nl = (const char*)memchr(s.data(), '\n', s.size());
+                const size_t line = nl ? nl - s.data() : s.size();
+                if (line < (size_t)sink_->policy().buf_size()) k = 0;
+            }
+        }
+        if (k) write(s.substr(0, k));
+        return k;
+    }
+    void mark(int64_t now, bool wait) {
+        marker_.mark(now, bol_, [&](auto s) {
+            if (!wait && sink_->Headroom() < s.size()) return false;
+            write(s);
+            return true;
+        });
+    }
+    void drop(std::string_view s) {
+        sink_->policy().loss().add(s);
+        marker_.add(s.size(), std::count(s.begin(), s.end(), '\n'));
+    }
+    // writes what the fd gave or holds it back, as the overload policy says
+    void log(std::string_view s) {
+        if (s.empty()) return;
+        if (overload_ == Overload::block) return write(s);
+        if (held_.empty()) s.remove_prefix(offer(s));
+        if (s.empty()) return;
+        if (overload_ == Overload::drop_newest && held_bytes_ + s.size() > spill_) {
+            return drop(s);
+        }
+        if (held_.empty() || held_.back().size() + s.size() > chunk) held_.emplace_back();
+        held_.back() += s;
+        held_bytes_ += s.size();
+        // the oldest whole lines go, as many as it takes to fit
+        while (overload_ == Overload::drop_oldest && held_bytes_ > spill_) {
+            auto f = std::string_view{held_.front()}.substr(off_);
+            const auto excess = held_bytes_ - spill_;
+            auto k = f.size();
+            if (excess < k) {
+                auto e = (const char*)memchr(&f[excess - 1], '\n', k - excess + 1);
+                if (e) k = e - f.data() + 1;
+            }
+            drop(f.substr(0, k));
+            held_bytes_ -= k;
+            off_ += k;
+            if (k < f.size()) break;
+            held_.pop_front();
+            off_ = 0;
+        }
+    }
+    // writes held data while the file takes it without waiting, or all of it
+    void pump(bool wait) {
+        while (!held_.empty()) {
+            auto f = std::string_view{held_.front()}.substr(off_);
+            const auto k = wait ? (write(f), f.size()) : offer(f);
+            held_bytes_ -= k;
+            off_ += k;
+            if (k < f.size()) break;
+            held_.pop_front();
+            off_ = 0;
+        }
+        if (held_.empty()) mark(wait ? INT64_MAX : last_, wait);
+    }
 
    public:
-    proxy(int fd, std::shared_ptr<LOGGER> logger)
-        : source_{fd}, last_{0}, sink_{std::move(logger)} {}
+    proxy(int fd, std::shared_ptr<LOGGER> logger, size_t splice, int tag)
+        : source_{fd},
+          last_{0},
+          sink_{std::move(logger)},
+          splice_{splice},
+          tag_{tag},
+          overload_{sink_->policy().options().overload},
+          spill_{(size_t)sink_->policy().options().spill},
+          off_{0},
+          held_bytes_{0},
+          marker_{sink_->policy().options().loss_marker},
+          bol_{true} {
+        if (auto n = sink_->policy().options().max_line; n > 0) {
+            framer_ = std::make_unique<framer>(n);
+        }
+    }
     ~proxy() {
+        if (framer_) framer_->flush([this](auto s) { log(s); });
+        pump(true);
         close(source_);
     }
 
     bool on_event() override {
+        last_ = current_seconds();
+        pump(false);
+        if (framer_) {
+            auto n = framer_->read(source_, [this](auto s) { log(s); });
+            SLOG_PROBE(read, tag_, n);
+            if (n > 0) {
+                bytes += n;
+                return true;
+            }
+            if (n == -1 && (errno == EAGAIN || errno == EINTR)) return true;
+            framer_->flush([this](auto s) { log(s); });
+            return false;
+        }
+
+        if (splice_) {
+            auto n = sink_->Splice(source_, splice_, {last_});
+            SLOG_PROBE(read, tag_, n);
+            if (n > 0) {
+                bytes += n;
+                return true;
+            }
+            if (n == 0) return false;
+            if (errno == EAGAIN || errno == EINTR) return true;
+            // e.g. the fallback stdout is not spliceable
+            if (errno != EINVAL) return false;
+            splice_ = 0;
+        }
+
         char buf[1024];
         int n = read(source_, buf, sizeof(buf));
+        SLOG_PROBE(read, tag_, n);
         if (n <= 0) {
             if (errno == EAGAIN /* unlikely */ || errno == EINTR) return true;
             return false;
         }
-        sink_->Log({buf, (size_t)n}, {last_ = current_seconds()});
+        log({buf, (size_t)n});
+        bytes += n;
         return true;
     }
 
     void on_timeout(int now) override {
+        if (framer_ && last_ + sink_->policy().options().line_timeout <= now) {
+            framer_->flush([this](auto s) { log(s); });
+        }
+        if (held_.empty()) mark(now, false);
         if (last_ + 10 > now) return;
         last_ = now;
         sink_->Flush();
     }
 
+    int backlog() override {
+        if (held_.empty()) return 0;
+        return overload_ == Overload::spill && held_bytes_ >= spill_ ? 2 : 1;
+    }
+    void on_retry() override {
+        last_ = current_seconds();
+        pump(false);
+    }
+
     int fd() override {
         return source_;
     }
 };
 
 template <typename LOGGER>
-proxy(int, std::shared_ptr<LOGGER>) -> proxy<LOGGER>;
+proxy(int, std::shared_ptr<LOGGER>, size_t, int) -> proxy<LOGGER>;
 
-class async_logger {
+template <typename LOGGER>
+class drainer : public event_handler {
+    std::shared_ptr<Queue> source_;
+    int last_;
+    std::shared_ptr<LOGGER> sink_;
+    std::string scratch_;
+    std::string text_;
+    loss_marker marker_;
+    uint64_t lost_bytes_;  // of the queue, accounted so far
+    uint64_t lost_lines_;
+    bool bol_;
+
+    void write(std::string_view s, int64_t seconds) {
+        sink_->Log(s, {seconds});
+        if (!s.empty()) bol_ = s.back() == '\n';
+    }
+    void mark(int64_t now) {
+        auto& lost = source_->lost();
+        const auto b = lost.bytes.load(std::memory_order_relaxed);
+        const auto l = lost.lines.load(std::memory_order_relaxed);
+        if (b != lost_bytes_) {
+            auto& total = sink_->policy().loss();
+            total.bytes.fetch_add(b - lost_bytes_, std::memory_order_relaxed);
+            total.lines.fetch_add(l - lost_lines_, std::memory_order_relaxed);
+            marker_.add(b - lost_bytes_, l - lost_lines_);
+            lost_bytes_ = b;
+            lost_lines_ = l;
+        }
+        marker_.mark(now, bol_, [this](auto s) {
+            write(s, current_seconds());
+            return true;
+        });
+    }
+
+   public:
+    drainer(std::shared_ptr<Queue> queue, std::shared_ptr<LOGGER> logger)
+        : source_{std::move(queue)},
+          last_{0},
+          sink_{std::move(logger)},
+          marker_{sink_->policy().options().loss_marker},
+          lost_bytes_{0},
+          lost_lines_{0},
+          bol_{true} {}
+    ~drainer() {
+        on_event();
+        mark(INT64_MAX);
+    }
+
+    bool on_event() override {
+        bool drained = false;
+        while (source_->ring_.pop(scratch_, [this](auto s, auto seconds, auto tag) {
+            if (tag == Queue::captured) s = Queue::render(s, text_);
+            write(s, seconds);
+            bytes += s.size();
+        })) {
+            drained = true;
+        }
+        if (drained) last_ = current_seconds();
+        if (source_->drop_) mark(last_);
+        return true;
+    }
+
+    void on_timeout(int now) override {
+        if (last_ + 10 > now) return;
+        last_ = now;
+        sink_->Flush();
+    }
+
+    int fd() override {
+        return -1;
+    }
+};
+
+class async_logger;
+
+// one epoll thread and the fds and queues assigned to it
+class worker {
+    async_logger& pool_;
     int poller_;
     int term_;
-    internal::dl_node handlers_;
+    int wake_;
+    internal::dl_node handlers_;  // the worker thread's only
+    internal::dl_node queues_;
     std::mutex mutex_;
-    pthread_t worker_;
-    std::atomic_int64_t seconds_;
+    std::vector<event_handler*> incoming_;
+    std::vector<event_handler*> retry_;  // with a backlog
+    pthread_t thread_;
+    std::atomic_int timeout_;
+    std::atomic_int count_;      // fds, incoming included
+    std::atomic<uint64_t> load_;  // bytes handled in the last rebalance period
+    uint64_t epoch_;              // the period `load_` covers
+    std::atomic<worker*> shed_to_;
+    std::atomic<uint64_t> gap_;
+    WorkerMetrics metrics_;
+
+    void drain() {
+        std::scoped_lock lock{mutex_};
+        queues_.iter([](auto p) {
+            static_cast<event_handler*>(p)->on_event();
+            return 0;
+        });
+    }
 
     void tick() {
-        struct timeval tv {};
-        gettimeofday(&tv, nullptr);
-        seconds_.store(tv.tv_sec, std::memory_order_relaxed);
+        internal::wall.tick();
+    }
+
+    // polls the fds handed over by adopt
+    void take() {
+        eventfd_t v;
+        eventfd_read(wake_, &v);
+        std::vector<event_handler*> v2;
+        {
+            std::scoped_lock lock{mutex_};
+            v2.swap(incoming_);
+        }
+        for (auto h : v2) {
+            handlers_.on(h);
+            struct epoll_event ev {};
+            ev.events = EPOLLIN;
+            ev.data.ptr = h;
+            epoll_ctl(poller_, EPOLL_CTL_ADD, h->fd(), &ev);
+        }
+    }
+
+    // closes the load figures of a rebalance period
+    void roll(uint64_t epoch) {
+        epoch_ = epoch;
+        uint64_t sum = 0;
+        auto f = [&](auto p) {
+            auto h = static_cast<event_handler*>(p);
+            h->recent = h->bytes - h->mark;
+            h->mark = h->bytes;
+            sum += h->recent;
+            return 0;
+        };
+        handlers_.iter(f);
+        {
+            std::scoped_lock lock{mutex_};
+            queues_.iter(f);
+        }
+        load_.store(sum, std::memory_order_relaxed);
+    }
+
+    // moves the fd that best halves the gap to a shed() target; one busier than the
+    // gap would only swap the roles
+    void give() {
+        auto to = shed_to_.exchange(nullptr, std::memory_order_acquire);
+        if (!to) return;
+        const auto gap = gap_.load(std::memory_order_relaxed);
+        event_handler* best = nullptr;
+        auto off = [=](auto h) {
+            return h->recent * 2 > gap ? h->recent * 2 - gap : gap - h->recent * 2;
+        };
+        handlers_.iter([&](auto p) {
+            auto h = static_cast<event_handler*>(p);
+            // a backlog stays with the worker retrying it
+            if (h->retrying || h->recent == 0 || h->recent >= gap) return 0;
+            if (!best || off(h) < off(best)) best = h;
+            return 0;
+        });
+        if (!best) return;
+        epoll_ctl(poller_, EPOLL_CTL_DEL, best->fd(), nullptr);
+        best->off();
+        count_.fetch_sub(1, std::memory_order_relaxed);
+        load_.fetch_sub(best->recent, std::memory_order_relaxed);
+        to->adopt(best);
+    }
+
+    // retries `h` until its backlog is written, and polls its fd only while it has room
+    void track(event_handler* h) {
+        const int b = h->backlog();
+        if (b > 0 && !h->retrying) {
+            h->retrying = true;
+            retry_.push_back(h);
+        }
+        if ((b == 2) != h->paused) {
+            h->paused = b == 2;
+            struct epoll_event ev {};
+            ev.events = h->paused ? 0u : (uint32_t)EPOLLIN;
+            ev.data.ptr = h;
+            epoll_ctl(poller_, EPOLL_CTL_MOD, h->fd(), &ev);
+        }
     }
 
+    void retry() {
+        for (size_t i = 0; i < retry_.size();) {
+            auto h = retry_[i];
+            h->on_retry();
+            track(h);
+            if (h->backlog() > 0) {
+                ++i;
+                continue;
+            }
+            h->retrying = false;
+            retry_[i] = retry_.back();
+            retry_.pop_back();
+        }
+    }
+
+    void maintain(int now);
+
     void run() {
         const int max_events = 8;
         struct epoll_event events[max_events];
+        int last = 0;
         for (;;) {
-            int n = epoll_wait(poller_, events, max_events, 1000);
+            // a backlog is retried every millisecond
+            const int timeout =
+                retry_.empty() ? timeout_.load(std::memory_order_relaxed) : 1;
+            int n = epoll_wait(poller_, events, max_events, timeout);
+            SLOG_PROBE(wakeup, n);
             if (n == 0) {
+                metrics_.timeouts.Add(1);
                 tick();
-                int now = seconds_.load(std::memory_order_relaxed);
-                handlers_.iter([=](auto p) {
+                drain();
+                retry();
+                int now = current_seconds();
+                maintain(now);
+                // queues shorten the timeout, keep the idle check at 1s granularity
+                if (now == last) continue;
+                last = now;
+                auto f = [=](auto p) {
                     static_cast<event_handler*>(p)->on_timeout(now);
                     return 0;
-                });
+                };
+                handlers_.iter(f);
+                std::scoped_lock lock{mutex_};
+                queues_.iter(f);
                 continue;
             }
             if (n == -1) {
@@ -93,53 +528,252 @@ class async_logger {
                 // unrecoverable
                 break;
             }
+            metrics_.wakeups.Add(1);
+            metrics_.events.Add(n);
             for (int i = 0; i < n; ++i) {
                 if (events[i].data.ptr == &term_) return;
+                if (events[i].data.ptr == &wake_) {
+                    take();
+                    continue;
+                }
                 auto h = (event_handler*)events[i].data.ptr;
-                if (!h->on_event()) {
-                    epoll_ctl(poller_, EPOLL_CTL_DEL, h->fd(), nullptr);
-                    std::scoped_lock lock{mutex_};
-                    delete h;
+                if (h->on_event()) {
+                    track(h);
+                    continue;
                 }
+                epoll_ctl(poller_, EPOLL_CTL_DEL, h->fd(), nullptr);
+                count_.fetch_sub(1, std::memory_order_relaxed);
+                if (h->retrying) retry_.erase(std::find(retry_.begin(), retry_.end(), h));
+                delete h;
             }
             tick();
+            drain();
+            retry();
+            maintain(current_seconds());
         }
     }
 
    public:
-    async_logger() {
+    worker(async_logger& pool, int id, int cpu)
+        : pool_{pool},
+          timeout_{1000},
+          count_{0},
+          load_{0},
+          epoch_{0},
+          shed_to_{nullptr},
+          gap_{0} {
         poller_ = epoll_create1(EPOLL_CLOEXEC);
         term_ = eventfd(0, EFD_CLOEXEC);
+        wake_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
 
         struct epoll_event ev {};
         ev.events = EPOLLIN;
         ev.data.ptr = &term_;
         epoll_ctl(poller_, EPOLL_CTL_ADD, term_, &ev);
-
-        tick();
+        ev.data.ptr = &wake_;
+        epoll_ctl(poller_, EPOLL_CTL_ADD, wake_, &ev);
 
         pthread_create(
-            &worker_, nullptr,
+            &thread_, nullptr,
             +[](void* p) {
-                static_cast<async_logger*>(p)->run();
+                static_cast<worker*>(p)->run();
                 return p;
             },
             this);
+        pthread_setname_np(thread_, ("slog-" + std::to_string(id)).c_str());
+        if (cpu >= 0) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            pthread_setaffinity_np(thread_, sizeof(set), &set);
+        }
     }
 
-    ~async_logger() {
+    // the thread exits, the fds and queues stay until destruction
+    void stop() {
         eventfd_write(term_, 1);
-        pthread_join(worker_, nullptr);
+        pthread_join(thread_, nullptr);
+    }
 
-        handlers_.iter([](auto p) {
+    ~worker() {
+        auto f = [](auto p) {
             delete static_cast<event_handler*>(p);
             return 0;
-        });
+        };
+        handlers_.iter(f);
+        for (auto h : incoming_) delete h;
+        // drainers flush what is left in their queues
+        queues_.iter(f);
 
+        close(wake_);
         close(term_);
         close(poller_);
     }
 
+    // hands `h` over to the worker thread, which starts polling it
+    void adopt(event_handler* h) {
+        {
+            std::scoped_lock lock{mutex_};
+            incoming_.push_back(h);
+        }
+        count_.fetch_add(1, std::memory_order_relaxed);
+        eventfd_write(wake_, 1);
+    }
+
+    void attach(event_handler* h) {
+        std::scoped_lock lock{mutex_};
+        queues_.on(h);
+        // producers never wake the worker up, poll the queues instead
+        timeout_.store(1, std::memory_order_relaxed);
+    }
+
+    // asks the worker to move an fd of about half `gap` bytes of load to `to`
+    void shed(worker* to, uint64_t gap) {
+        gap_.store(gap, std::memory_order_relaxed);
+        shed_to_.store(to, std::memory_order_release);
+    }
+
+    int count() const {
+        return count_.load(std::memory_order_relaxed);
+    }
+    uint64_t load() const {
+        return load_.load(std::memory_order_relaxed);
+    }
+    WorkerMetrics::Snapshot stats() const {
+        return {metrics_.wakeups.Get(), metrics_.timeouts.Get(), metrics_.events.Get(),
+                count()};
+    }
+};
+
+static std::atomic_bool started{false};
+
+static Workers& workers() {
+    static Workers w;
+    return w;
+}
+
+bool Workers::Set(Workers w) {
+    if (started.load()) return false;
+    workers() = std::move(w);
+    return true;
+}
+
+static std::string render(const Histogram::Snapshot& h, std::string_view name) {
+    return internal::format(" {}.p50={} {}.p99={} {}.max={}"_fmt, name, h.Quantile(0.5),
+                            name, h.Quantile(0.99), name, h.max);
+}
+
+// one line per worker and logger, as key=value pairs; replaced atomically
+static void write_stats(const std::string& path, int now, const Workers::Stats& s) {
+    auto out = internal::format("time={}\n"_fmt, now);
+    for (size_t i = 0; i < s.workers.size(); ++i) {
+        auto& w = s.workers[i];
+        out += internal::format("worker={} fds={} wakeups={} timeouts={}"_fmt, i, w.fds,
+                                w.wakeups, w.timeouts);
+        out += render(w.events, "events");
+        out += '\n';
+    }
+    for (auto& [name, m] : s.loggers) {
+        out += internal::format("logger={} accepted={} written={} writes={} syncs={}"_fmt,
+                                name, m.accepted, m.written, m.writes, m.syncs);
+        out += internal::format(" full={} rotations={}"_fmt, m.full, m.rotations);
+        out += render(m.write_ns, "write_ns");
+        out += render(m.flush_ns, "flush_ns");
+        out += render(m.rotate_ns, "rotate_ns");
+        out += '\n';
+    }
+    const auto tmp = path + ".tmp";
+    const int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return;
+    const bool ok = write(fd, out.data(), out.size()) == (ssize_t)out.size();
+    close(fd);
+    if (ok) rename(tmp.c_str(), path.c_str());
+}
+
+class async_logger {
+    const Workers o_;
+    std::vector<std::unique_ptr<worker>> workers_;
+    std::atomic<uint64_t> epoch_;
+    std::atomic_int next_;  // seconds of the next rebalance
+    std::atomic_int queues_;
+    std::atomic_int next_stats_;  // seconds of the next stats file
+    std::mutex mutex_;
+    std::vector<std::pair<std::string, std::weak_ptr<const Metrics>>> loggers_;
+
+    template <typename LOGGER>
+    void track(const std::shared_ptr<LOGGER>& logger) {
+        std::scoped_lock lock{mutex_};
+        // dropped with the logger
+        loggers_.emplace_back(logger->policy().slink(),
+                              std::shared_ptr<const Metrics>{logger, &logger->metrics()});
+    }
+
+   public:
+    explicit async_logger(Workers o)
+        : o_{std::move(o)}, epoch_{0}, next_{0}, queues_{0}, next_stats_{0} {
+        const int n = std::max(o_.n, 1);
+        for (int i = 0; i < n; ++i) {
+            const int cpu = o_.cpus.empty() ? -1 : o_.cpus[i % o_.cpus.size()];
+            workers_.push_back(std::make_unique<worker>(*this, i, cpu));
+        }
+    }
+
+    ~async_logger() {
+        // no fd moves between workers once any of them stops
+        for (auto& w : workers_) w->stop();
+        workers_.clear();
+    }
+
+    uint64_t epoch() const {
+        return epoch_.load(std::memory_order_acquire);
+    }
+
+    // run by whichever worker gets there first once a period is over: the busiest
+    // worker sheds an fd to the idlest one if it has twice its load
+    void rebalance(int now) {
+        if (o_.rebalance <= 0 || workers_.size() < 2) return;
+        auto t = next_.load(std::memory_order_relaxed);
+        if (now < t || !next_.compare_exchange_strong(t, now + o_.rebalance)) return;
+        if (t > 0) {
+            auto [a, b] = std::minmax_element(
+                workers_.begin(), workers_.end(),
+                [](auto& x, auto& y) { return x->load() > y->load(); });
+            const auto hi = (*a)->load(), lo = (*b)->load();
+            if (hi > 2 * lo && hi - lo >= min_gap) (*a)->shed(b->get(), hi - lo);
+        }
+        epoch_.fetch_add(1, std::memory_order_release);
+    }
+
+    Workers::Stats stats() {
+        Workers::Stats s;
+        for (auto& w : workers_) s.workers.push_back(w->stats());
+        std::scoped_lock lock{mutex_};
+        auto end = std::remove_if(loggers_.begin(), loggers_.end(), [&](auto& l) {
+            auto m = l.second.lock();
+            if (m) s.loggers.emplace_back(l.first, m->Get());
+            return !m;
+        });
+        loggers_.erase(end, loggers_.end());
+        return s;
+    }
+
+    // run by whichever worker gets there first once the interval is over
+    void dump(int now) {
+        if (o_.stats_file.empty()) return;
+        auto t = next_stats_.load(std::memory_order_relaxed);
+        const int next = now + std::max(o_.stats_interval, 1);
+        if (now < t || !next_stats_.compare_exchange_strong(t, next)) return;
+        write_stats(o_.stats_file, now, stats());
+    }
+
+    // the worker for redirected fd `fd`
+    worker& pick(int fd) {
+        if (!o_.by_load) return *workers_[fd % workers_.size()];
+        return **std::min_element(workers_.begin(), workers_.end(), [](auto& x, auto& y) {
+            return std::pair{x->load(), x->count()} < std::pair{y->load(), y->count()};
+        });
+    }
+
     template <typename LOGGER>
     void redirect(int fd, std::shared_ptr<LOGGER> logger) {
         int fds[2]{};
@@ -147,40 +781,168 @@ class async_logger {
         dup2(fds[1], fd);
         close(fds[1]);
 
-        struct epoll_event ev {};
-        ev.events = EPOLLIN;
-        auto p = new proxy{fds[0], std::move(logger)};
-        ev.data.ptr = p;
-        std::scoped_lock lock{mutex_};
-        handlers_.on(p);
-        epoll_ctl(poller_, EPOLL_CTL_ADD, fds[0], &ev);
+        auto& o = logger->policy().options();
+        if (o.pipe_size > 0) fcntl(fds[0], F_SETPIPE_SZ, o.pipe_size);
+        size_t splice = 0;
+        // these need the data in user space
+        const bool copy =
+            o.max_line || !o.prefix.empty() || o.overload != Overload::block;
+        if (int n = fcntl(fds[0], F_GETPIPE_SZ); o.splice && !copy && n > 0) {
+            splice = n;
+        }
+
+        track(logger);
+        pick(fd).adopt(new proxy{fds[0], std::move(logger), splice, fd});
     }
 
-    auto current_seconds() const {
-        return seconds_.load(std::memory_order_relaxed);
+    template <typename LOGGER>
+    void attach(std::shared_ptr<Queue> queue, std::shared_ptr<LOGGER> logger) {
+        track(logger);
+        auto p = new drainer{std::move(queue), std::move(logger)};
+        auto& w = o_.by_load ? pick(0) : *workers_[queues_++ % workers_.size()];
+        w.attach(p);
     }
 
     static auto& instance() {
-        static async_logger obj;
+        started.store(true);
+        static async_logger obj{workers()};
         return obj;
     }
+
+    static constexpr uint64_t min_gap = 64 * 1024;
 };
 
-int64_t current_seconds() {
-    return async_logger::instance().current_seconds();
+void worker::maintain(int now) {
+    if (auto e = pool_.epoch(); e != epoch_) roll(e);
+    pool_.rebalance(now);
+    give();
+    pool_.dump(now);
+}
+
+Workers::Stats Workers::Snapshot() {
+    if (!started.load()) return {};
+    return async_logger::instance().stats();
+}
+
+template <typename ROTATE_POLICY>
+Logger<ROTATE_POLICY>::Logger(std::shared_ptr<ROTATE_POLICY> p)
+    : p_{std::move(p)}, bol_{true} {
+    next();
+    if (auto& spec = p_->policy().options().prefix; !spec.empty()) {
+        prefix_ = std::make_unique<internal::prefixer>(spec);
+    }
+}
+
+template <typename ROTATE_POLICY>
+void Logger<ROTATE_POLICY>::next() {
+    const auto start = internal::monotonic_nanos();
+    f_ = p_->Next();
+    f_->set_metrics(&metrics_);
+    metrics_.rotate_ns.Add(internal::monotonic_nanos() - start);
+    metrics_.rotations.Add(1);
+    defined_.clear();
 }
 
 template <typename ROTATE_POLICY>
 void Logger<ROTATE_POLICY>::Log(std::string_view s, metadata m) {
-    f_->Write(s);
-    if (p_->Spill({s.size(), m.event_time})) {
-        f_ = p_->Next();
+    size_t n = s.size();
+    if (prefix_) {
+        n = prefixed(s, m.fd);
+    } else {
+        f_->Write(s);
+    }
+    metrics_.accepted.Add(n);
+    f_->Stamp(m.event_time);
+    if (p_->Spill({n, m.event_time})) next();
+}
+
+template <typename ROTATE_POLICY>
+size_t Logger<ROTATE_POLICY>::prefixed(std::string_view s, int fd) {
+    if (s.empty()) return 0;
+    // the lines of one write share the prefix
+    const auto p = prefix_->get(current_nanos(), tid, fd);
+    size_t n = 0;
+    while (!s.empty()) {
+        auto e = (const char*)memchr(s.data(), '\n', s.size());
+        const size_t k = e ? e - s.data() + 1 : s.size();
+        const size_t m = (bol_ ? p.size() : 0) + k;
+        if (auto out = f_->Reserve(m)) {
+            if (bol_) memcpy(out, p.data(), p.size());
+            memcpy(out + m - k, s.data(), k);
+            f_->Commit(m);
+        } else {
+            if (bol_) f_->Write(p);
+            f_->Write(s.substr(0, k));
+        }
+        n += m;
+        s.remove_prefix(k);
+        bol_ = e != nullptr;
     }
+    return n;
 }
 
 template <typename ROTATE_POLICY>
 void Logger<ROTATE_POLICY>::Flush() {
+    const auto start = internal::monotonic_nanos();
     f_->Flush();
+    metrics_.flush_ns.Add(internal::monotonic_nanos() - start);
+}
+
+template <typename ROTATE_POLICY>
+ssize_t Logger<ROTATE_POLICY>::Splice(int fd, size_t n, metadata m) {
+    auto r = internal::counted_write(&metrics_, [&] { return f_->Splice(fd, n); });
+    if (r > 0) metrics_.accepted.Add(r);
+    if (r > 0 && p_->Spill({(uint64_t)r, m.event_time})) next();
+    return r;
+}
+
+template <typename ROTATE_POLICY>
+size_t Logger<ROTATE_POLICY>::define(uint32_t site) {
+    const auto s = binlog::definition(site);
+    f_->Write(s);
+    if (site >= defined_.size()) defined_.resize(site + 1);
+    defined_[site] = true;
+    return s.size();
+}
+
+template <typename ROTATE_POLICY>
+std::shared_ptr<Queue> Logger<ROTATE_POLICY>::Async(std::shared_ptr<ROTATE_POLICY> p,
+                                                    int capacity) {
+    // the ring is the spill, only the drop policies drop; the producers cannot take
+    // records back from the worker's end of the ring, drop_oldest drops the newest
+    const auto o = p->policy().options().overload;
+    const bool drop = o == Overload::drop_newest || o == Overload::drop_oldest;
+    auto q = Queue::of(capacity, drop);
+    async_logger::instance().attach(q, of(std::move(p)));
+    return q;
+}
+
+static uint64_t ceil_pow2(uint64_t n) {
+    uint64_t r = 2;
+    while (r < n) r <<= 1;
+    return r;
+}
+
+Queue::Queue(int capacity, bool drop)
+    : ring_{ceil_pow2(capacity)},
+      max_record_{ring_.capacity() / 2 * internal::mpsc_ring::payload},
+      drop_{drop} {}
+
+std::string_view Queue::render(std::string_view record, std::string& out) {
+    internal::renderer r;
+    memcpy(&r, record.data(), sizeof(r));
+    const auto args = record.data() + sizeof(r);
+    if (out.size() < 256) out.resize(256);
+    auto n = r(out.data(), out.size(), args);
+    if (n > out.size()) {
+        out.resize(n);
+        r(out.data(), n, args);
+    }
+    return {out.data(), n};
+}
+
+std::shared_ptr<Queue> Queue::of(int capacity, bool drop) {
+    return std::make_shared<trampoline<Queue>>(capacity, drop);
 }
 
 template <>
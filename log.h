@@ -1,25 +1,112 @@
 #pragma once
 
 #include <memory>
+#include <string>
 #include <string_view>
+#include <utility>
+#include <vector>
+#include "binlog.h"
+#include "capture.h"
+#include "clock.h"
 #include "file.h"
+#include "prefix.h"
+#include "ring.h"
 
 namespace slog {
 
+class Queue;
+
+// the async workers behind Redirect and Async; Set takes effect only before the first
+// of them and returns false after
+struct Workers {
+    int n{1};
+    // a new fd goes to the least loaded worker, otherwise to worker fd % n
+    bool by_load{false};
+    // seconds between moves of an fd from the busiest worker to the idlest, 0 never
+    int rebalance{0};
+    // worker i runs on cpus[i % cpus.size()], empty for any cpu
+    std::vector<int> cpus;
+    // rewritten by a worker every `stats_interval` seconds with the metrics of the
+    // workers and their loggers, empty for none
+    std::string stats_file;
+    int stats_interval{10};
+
+    static bool Set(Workers w);
+
+    struct Stats {
+        std::vector<WorkerMetrics::Snapshot> workers;
+        // of the redirected fds and queues, by the symlink of their segments
+        std::vector<std::pair<std::string, Metrics::Snapshot>> loggers;
+    };
+    // empty before the first Redirect or Async
+    static Stats Snapshot();
+};
+
+extern int pid;
+extern thread_local int tid;
+
 template <typename ROTATE_POLICY>
 class Logger {
     struct metadata {
         int64_t event_time;  // seconds
+        int fd{-1};          // the redirected fd the data came from
     };
     std::shared_ptr<ROTATE_POLICY> p_;
+    Metrics metrics_;  // before `f_`, which counts in it
     std::shared_ptr<File> f_;
+    std::vector<bool> defined_;  // binlog sites defined in the active file
+    std::unique_ptr<internal::prefixer> prefix_;
+    bool bol_;  // the next write starts a line
 
-    Logger(std::shared_ptr<ROTATE_POLICY> p) : p_{std::move(p)}, f_{p_->Next()} {}
+    Logger(std::shared_ptr<ROTATE_POLICY> p);
     friend class trampoline<Logger>;
 
+    void next();
+    size_t define(uint32_t site);
+    // writes `s` with the prefix in front of each line, returns the bytes written
+    size_t prefixed(std::string_view s, int fd);
+
    public:
+    // the prefix, if set, carries the time of the call and the calling thread
     void Log(std::string_view s, metadata m);
     void Flush();
+    // moves pending data of pipe `fd` into the active file, returns the bytes moved
+    ssize_t Splice(int fd, size_t n, metadata m);
+    auto& policy() const {
+        return p_->policy();
+    }
+    // bytes that go in without waiting for the disk, not counting prefixes
+    size_t Headroom() {
+        return f_->Headroom();
+    }
+    const Metrics& metrics() const {
+        return metrics_;
+    }
+
+    // formats straight into the active file's buffer
+    template <typename FMT, typename... ARGS>
+    void Logf(FMT fmt, const ARGS&... args) {
+        const auto n = f_->Format(fmt, args...);
+        metrics_.accepted.Add(n);
+        const auto t = current_seconds();
+        f_->Stamp(t);
+        if (p_->Spill({n, t})) next();
+    }
+
+    // writes a binary record, rendered offline by binlog::decoder; `fmt` must be a
+    // static format, e.g. "{} took {} us"_fmt
+    template <typename FMT, typename... ARGS>
+    void Logb(FMT, const ARGS&... args) {
+        const auto site = binlog::site_id<FMT, ARGS...>();
+        size_t n = 0;
+        if (site >= defined_.size() || !defined_[site]) n = define(site);
+        const auto ns = current_nanos();
+        n += binlog::write(*f_, site, ns, binlog::lower(args)...);
+        metrics_.accepted.Add(n);
+        const auto t = ns / 1000000000;
+        f_->Stamp(t);
+        if (p_->Spill({n, t})) next();
+    }
 
     static void Redirect(int fd, std::string name);
     static void Redirect(int fd, std::shared_ptr<ROTATE_POLICY> p);
@@ -27,10 +114,75 @@ class Logger {
     static std::shared_ptr<Logger> of(std::shared_ptr<ROTATE_POLICY> p) {
         return std::make_shared<trampoline<Logger>>(std::move(p));
     }
+
+    // thread-safe front end, drained by the async worker
+    static std::shared_ptr<Queue> Async(std::shared_ptr<ROTATE_POLICY> p,
+                                        int capacity = 4096);
 };
 
-extern int pid;
-extern thread_local int tid;
-extern int64_t current_seconds();
+template <typename LOGGER>
+class drainer;
+
+class Queue {
+    enum : uint32_t { text, captured };
+
+    internal::mpsc_ring ring_;
+    const size_t max_record_;
+    const bool drop_;  // drops a record the full ring cannot take
+    Loss lost_;
+    Queue(int capacity, bool drop);
+    friend class trampoline<Queue>;
+    template <typename LOGGER>
+    friend class drainer;
+
+    template <typename FMT, typename... ARGS>
+    void capture(FMT fmt, int64_t seconds, const ARGS&... args) {
+        const auto n = internal::captured_record_size(args...);
+        // a record never spans pushes
+        if (n > max_record_) return Log(internal::format(fmt, args...), seconds);
+        char buf[1024];
+        std::string big;
+        auto p = n <= sizeof(buf) ? buf : (big.resize(n), big.data());
+        internal::put_record<FMT>(p, args...);
+        while (!ring_.push({p, n}, seconds, captured)) {
+            if (drop_) return lost_.add(internal::format(fmt, args...));
+            internal::cpu_relax();
+        }
+    }
+    // the text of a captured record, rendered into `out`
+    static std::string_view render(std::string_view record, std::string& out);
+
+   public:
+    // never blocks on a syscall, spins only while the ring is full unless it drops
+    void Log(std::string_view s, int64_t seconds) {
+        do {
+            auto t = s.substr(0, max_record_);
+            while (!ring_.push(t, seconds, text)) {
+                if (drop_) return lost_.add(s);
+                internal::cpu_relax();
+            }
+            s.remove_prefix(t.size());
+        } while (!s.empty());
+    }
+    void Log(std::string_view s) {
+        Log(s, current_seconds());
+    }
+    // copies the arguments and leaves the formatting to the async worker; `fmt` must
+    // be a static format, and captured types must not point to memory the caller frees
+    template <typename FMT, typename... ARGS>
+    void Logf(FMT fmt, const ARGS&... args) {
+        capture(fmt, current_seconds(), internal::capture(args)...);
+    }
+    bool empty() const {
+        return ring_.empty();
+    }
+    // dropped while the ring was full
+    const Loss& lost() const {
+        return lost_;
+    }
+
+    // `drop` drops what a full ring cannot take instead of waiting
+    static std::shared_ptr<Queue> of(int capacity, bool drop = false);
+};
 
 }  // namespace slog
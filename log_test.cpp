@@ -4,6 +4,7 @@
 #include "str.h"
 
 int main(int argc, char* argv[]) {
+    using slog::operator""_fmt;
     slog::SizeRotate::Builder builder;
     builder.set_size(slog::Bytes::of("1m").value());
     builder.set_name("test"s).set_base("/tmp"s).set_num_files(6).set_buf_size(1024);
@@ -11,8 +12,6 @@ int main(int argc, char* argv[]) {
 
     const int n = argc < 2 ? 102400 : atoi(argv[1]);
     for (int i = 0; i < n; ++i) {
-        logger->Log(slog::internal::format(
-                        "#{} this is a test: abcd-efg-hi-jk-lmn-opq-rst-uvw-xyz\n"sv, i),
-                    {});
+        logger->Logf("#{} this is a test: abcd-efg-hi-jk-lmn-opq-rst-uvw-xyz\n"_fmt, i);
     }
 }
@@ -0,0 +1,106 @@
+#include "mapped.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+
+namespace slog {
+
+static bool trim(int fd, uint64_t n) {
+    return ftruncate(fd, n) == 0;
+}
+
+MappedFile::MappedFile(int fd, char* map, uint64_t size, uint64_t start)
+    : File{fd, Buf::of(map + start, size - start)}, map_{map}, size_{size}, over_{0} {}
+
+MappedFile::~MappedFile() {
+    // before the sync in Close, so the new size is synced too; on failure the zero
+    // tail stays for Recover
+    trim(fd_, used());
+    Close();
+    munmap(map_, size_);
+    buf_ = Buf::of(nullptr, 0);
+}
+
+uint64_t MappedFile::used() const {
+    return over_ ? size_ + over_ : buf_.Tail() - map_;
+}
+
+bool MappedFile::Drain() {
+    // already in the page cache
+    return true;
+}
+
+bool MappedFile::Put(std::string_view s) {
+    // fill the mapping, the rest goes past it
+    const auto n = std::min<size_t>(buf_.Room(), s.size());
+    memcpy(buf_.Tail(), s.data(), n);
+    buf_.Commit(n);
+    s.remove_prefix(n);
+    while (!s.empty()) {
+        auto r = internal::counted_write(
+            metrics_, [&] { return pwrite(fd_, s.data(), s.size(), size_ + over_); });
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        over_ += r;
+        s.remove_prefix(r);
+    }
+    return true;
+}
+
+int64_t MappedFile::Tell() {
+    return used();
+}
+
+void MappedFile::Advise(uint64_t end) {
+    // mapped pages are not dropped from the page cache, unmap them first
+    const uint64_t from = advised_ & ~(uint64_t)(getpagesize() - 1);
+    end = std::min(end, size_);
+    if (end > from) madvise(map_ + from, end - from, MADV_DONTNEED);
+    File::Advise(end);
+}
+
+ssize_t MappedFile::Splice(int, size_t) {
+    errno = EINVAL;
+    return -1;
+}
+
+std::shared_ptr<File> MappedFile::of(int fd, uint64_t size) {
+    struct stat st {};
+    if (size == 0 || size > INT_MAX) return nullptr;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) return nullptr;
+    const auto start = lseek(fd, 0, SEEK_CUR);
+    if (start < 0 || (uint64_t)start >= size) return nullptr;
+
+    // blocks are reserved up front, a full disk fails here instead of with SIGBUS
+    if (fallocate(fd, 0, 0, size) != 0) return nullptr;
+    auto p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        trim(fd, start);
+        return nullptr;
+    }
+    return std::make_shared<trampoline<MappedFile>>(fd, (char*)p, size, (uint64_t)start);
+}
+
+uint64_t MappedFile::Recover(const char* path, uint64_t size) {
+    int fd = open(path, O_RDWR);
+    if (fd < 0) return 0;
+    struct stat st {};
+    if (fstat(fd, &st) != 0) st.st_size = 0;
+    // any other size was set by the truncate on close, or by writes past the mapping
+    uint64_t end = st.st_size;
+    if (end == size) {
+        end = DataEnd(fd, end);
+        if (end != size && !trim(fd, end)) end = size;
+    }
+    close(fd);
+    return end;
+}
+
+}  // namespace slog
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <memory>
+#include "file.h"
+
+namespace slog {
+
+/*
+   File backend for segments of a known size: the file is preallocated and mapped, so a
+   write is a memcpy with no syscall. Data past the segment size goes through pwrite().
+   The file is truncated to its real length on close; after a crash it is left
+   preallocated to the segment size, Recover finds the end of data.
+ */
+class MappedFile : public File {
+    char* map_;
+    const uint64_t size_;
+    uint64_t over_;  // bytes written past the mapping
+
+    uint64_t used() const;
+
+   protected:
+    bool Drain() override;
+    bool Put(std::string_view s) override;
+    int64_t Tell() override;
+    void Advise(uint64_t end) override;
+
+    MappedFile(int fd, char* map, uint64_t size, uint64_t start);
+    friend class trampoline<MappedFile>;
+
+   public:
+    ~MappedFile() override;
+
+    // splice() would bypass the mapping, fails with EINVAL so callers fall back to read()
+    ssize_t Splice(int fd, size_t n) override;
+
+    // nullptr if `fd` is not a regular file, already holds `size` bytes or cannot be
+    // preallocated and mapped
+    static std::shared_ptr<File> of(int fd, uint64_t size);
+    // truncates the zero tail of a file left preallocated to `size`, returns its real
+    // size
+    static uint64_t Recover(const char* path, uint64_t size);
+};
+
+}  // namespace slog
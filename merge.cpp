@@ -0,0 +1,19 @@
+#include <stdio.h>
+#include <string>
+#include "shard.h"
+
+// prints the shards of a Sharded log in time order: slog_merge base name [ext]
+int main(int argc, char* argv[]) {
+    using namespace slog;
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s base name [ext]\n", argv[0]);
+        return 2;
+    }
+    auto shards = Merger::Shards(argv[1], argv[2], argc > 3 ? argv[3] : "log"s);
+    if (shards.empty()) {
+        fprintf(stderr, "%s: no shards of %s\n", argv[1], argv[2]);
+        return 1;
+    }
+    Merger m{std::move(shards)};
+    for (std::string s; m.Next(s);) fwrite(s.data(), 1, s.size(), stdout);
+}
@@ -0,0 +1,44 @@
+#include "metrics.h"
+#include <algorithm>
+#include <cmath>
+
+namespace slog {
+
+auto Histogram::Get() const -> Snapshot {
+    Snapshot s{};
+    for (int i = 0; i < buckets; ++i) {
+        s.counts[i] = counts_[i].load(std::memory_order_relaxed);
+        s.count += s.counts[i];
+    }
+    s.sum = sum_.load(std::memory_order_relaxed);
+    s.max = max_.load(std::memory_order_relaxed);
+    return s;
+}
+
+uint64_t Histogram::Snapshot::Quantile(double q) const {
+    if (count == 0) return 0;
+    // the rank of the quantile, 1-based
+    const auto rank = std::max<uint64_t>(1, std::ceil(q * count));
+    uint64_t seen = 0;
+    for (int i = 0; i < buckets; ++i) {
+        seen += counts[i];
+        if (seen < rank) continue;
+        if (i == buckets - 1) return max;
+        return std::min(Lower(i + 1) - 1, max);
+    }
+    return max;
+}
+
+auto Metrics::Get() const -> Snapshot {
+    return {accepted.Get(),
+            written.load(std::memory_order_relaxed),
+            writes.load(std::memory_order_relaxed),
+            syncs.load(std::memory_order_relaxed),
+            full.Get(),
+            rotations.Get(),
+            write_ns.Get(),
+            flush_ns.Get(),
+            rotate_ns.Get()};
+}
+
+}  // namespace slog
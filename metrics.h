@@ -0,0 +1,137 @@
+#pragma once
+
+#include <sys/types.h>
+#include <time.h>
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+namespace slog {
+
+/*
+   Log-linear histogram: four buckets per power of two, so a quantile is off by at
+   most 25%, in 252 buckets for the whole uint64_t range. Adds are relaxed atomics and
+   may come from any thread.
+ */
+class Histogram {
+   public:
+    static constexpr int sub = 2;  // log2 of the buckets per power of two
+    static constexpr int buckets = (65 - sub) << sub;
+
+    struct Snapshot {
+        uint64_t count;
+        uint64_t sum;
+        uint64_t max;
+        std::array<uint64_t, buckets> counts;
+
+        // the upper bound of the bucket holding quantile `q` in [0, 1], capped at the
+        // max; 0 if empty
+        uint64_t Quantile(double q) const;
+    };
+
+    static int Bucket(uint64_t v) {
+        if (v < (1u << sub)) return v;
+        const int e = 63 - __builtin_clzll(v);
+        return ((e - sub + 1) << sub) + ((v >> (e - sub)) & ((1u << sub) - 1));
+    }
+    // the smallest value of bucket `i`
+    static uint64_t Lower(int i) {
+        if (i < (1 << sub)) return i;
+        const int e = (i >> sub) + sub - 1;
+        return (uint64_t)((1u << sub) | (i & ((1u << sub) - 1))) << (e - sub);
+    }
+
+    void Add(uint64_t v) {
+        counts_[Bucket(v)].fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(v, std::memory_order_relaxed);
+        auto m = max_.load(std::memory_order_relaxed);
+        while (v > m && !max_.compare_exchange_weak(m, v, std::memory_order_relaxed)) {
+        }
+    }
+    Snapshot Get() const;
+
+   private:
+    std::array<std::atomic<uint64_t>, buckets> counts_{};
+    std::atomic<uint64_t> sum_{0};
+    std::atomic<uint64_t> max_{0};
+};
+
+// a counter with one writer at a time, read from any thread; no locked instruction
+class Counter {
+    std::atomic<uint64_t> v_{0};
+
+   public:
+    void Add(uint64_t n) {
+        v_.store(v_.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+    uint64_t Get() const {
+        return v_.load(std::memory_order_relaxed);
+    }
+};
+
+// what a logger and its files did
+struct Metrics {
+    // written on the logger's thread
+    Counter accepted;   // bytes handed to the logger, prefixes included
+    Counter full;       // buffers handed over because the next write did not fit
+    Counter rotations;  // segments opened
+    Histogram flush_ns;
+    Histogram rotate_ns;  // opening the next segment
+    // written where the I/O happens, e.g. on the flusher thread
+    std::atomic<uint64_t> written{0};  // bytes passed to write calls
+    std::atomic<uint64_t> writes{0};   // write() and pwrite() calls, io_uring writes
+    std::atomic<uint64_t> syncs{0};    // fdatasync() calls, io_uring ones included
+    Histogram write_ns;                // io_uring: from submission to completion
+
+    struct Snapshot {
+        uint64_t accepted;
+        uint64_t written;
+        uint64_t writes;
+        uint64_t syncs;
+        uint64_t full;
+        uint64_t rotations;
+        Histogram::Snapshot write_ns;
+        Histogram::Snapshot flush_ns;
+        Histogram::Snapshot rotate_ns;
+    };
+    Snapshot Get() const;
+};
+
+// what an async worker did
+struct WorkerMetrics {
+    Counter wakeups;   // epoll_wait() returns with events
+    Counter timeouts;  // epoll_wait() returns without
+    Histogram events;  // per wakeup
+
+    struct Snapshot {
+        uint64_t wakeups;
+        uint64_t timeouts;
+        Histogram::Snapshot events;
+        int fds;  // redirected fds polled, queues not included
+    };
+};
+
+namespace internal {
+
+inline int64_t monotonic_nanos() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+// runs `f`, a write call that returns what write() does, and counts it in `m` unless
+// it is null
+template <typename F>
+ssize_t counted_write(Metrics* m, F&& f) {
+    if (!m) return f();
+    const auto start = monotonic_nanos();
+    const ssize_t r = f();
+    m->write_ns.Add(monotonic_nanos() - start);
+    m->writes.fetch_add(1, std::memory_order_relaxed);
+    if (r > 0) m->written.fetch_add(r, std::memory_order_relaxed);
+    return r;
+}
+
+}  // namespace internal
+
+}  // namespace slog
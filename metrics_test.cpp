@@ -0,0 +1,146 @@
+#include <fcntl.h>
+#include <sys/poll.h>
+#include <unistd.h>
+#include <fstream>
+#include <sstream>
+#include "log.h"
+#include "metrics.h"
+#include "str.h"
+#include "test.h"
+
+static void write_all(int fd, std::string_view s) {
+    while (!s.empty()) {
+        auto n = write(fd, s.data(), s.size());
+        if (n > 0) {
+            s.remove_prefix(n);
+        } else if (errno == EAGAIN) {
+            pollfd out{fd, POLLOUT, 0};
+            poll(&out, 1, -1);
+        } else if (errno != EINTR) {
+            return;
+        }
+    }
+}
+
+static std::string slurp(const std::string& path) {
+    std::ifstream f{path};
+    return {std::istreambuf_iterator<char>{f}, {}};
+}
+
+// the value of `key=` in `s`, -1 if missing
+static int64_t field(const std::string& s, const std::string& key) {
+    auto i = s.find(' ' + key + '=');
+    if (i == std::string::npos) return -1;
+    return atoll(s.c_str() + i + key.size() + 2);
+}
+
+int main() {
+    using namespace slog;
+
+    // every value falls in its bucket, and buckets tile the range
+    for (uint64_t v : {0ull, 1ull, 3ull, 4ull, 7ull, 8ull, 9ull, 1000ull, 123456789ull,
+                       1ull << 40, ~0ull}) {
+        const int i = Histogram::Bucket(v);
+        EXPECT_TRUE(Histogram::Lower(i) <= v);
+        EXPECT_TRUE(i == Histogram::buckets - 1 || v < Histogram::Lower(i + 1));
+    }
+    for (int i = 1; i < Histogram::buckets; ++i) {
+        EXPECT_EQ(Histogram::Bucket(Histogram::Lower(i)), i);
+        EXPECT_EQ(Histogram::Bucket(Histogram::Lower(i) - 1), i - 1);
+    }
+    {
+        Histogram h;
+        for (uint64_t v = 1; v <= 1000; ++v) h.Add(v * 1000);
+        auto s = h.Get();
+        EXPECT_EQ(s.count, (uint64_t)1000);
+        EXPECT_EQ(s.sum, (uint64_t)500500000);
+        EXPECT_EQ(s.max, (uint64_t)1000000);
+        EXPECT_EQ(s.Quantile(1), s.max);
+        // within a quarter of the true value, never below it
+        for (double q : {0.01, 0.5, 0.9, 0.99}) {
+            const double exact = q * 1000 * 1000;
+            EXPECT_TRUE(s.Quantile(q) >= exact && s.Quantile(q) <= exact * 1.25);
+        }
+        EXPECT_EQ(Histogram{}.Get().Quantile(0.5), (uint64_t)0);
+    }
+
+    auto builder = [](bool flusher) {
+        unlink("/tmp/metrics_test.0.log");
+        unlink("/tmp/metrics_test.1.log");
+        SizeRotate::Builder b;
+        b.set_size("64k"_b)
+            .set_name("metrics_test"s)
+            .set_base("/tmp"s)
+            .set_num_files(2)
+            .set_buf_size("4k"_b)
+            .set_flusher(flusher ? 2 : 0);
+        return b.Build();
+    };
+    const std::string line = "the quick brown fox jumps over the lazy dog\n";
+    const int n = 4000;
+
+    // the caller's thread writes and syncs
+    {
+        auto log = Logger<SizeRotate>::of(builder(false));
+        for (int i = 0; i < n; ++i) log->Log(line, {0});
+        log->Flush();
+        auto m = log->metrics().Get();
+        EXPECT_EQ(m.accepted, n * line.size());
+        EXPECT_EQ(m.written, m.accepted);
+        EXPECT_EQ(m.write_ns.count, m.writes);
+        EXPECT_TRUE(m.writes >= m.full && m.full >= m.accepted / 4096 - 1);
+        EXPECT_TRUE(m.syncs >= 1);
+        EXPECT_EQ(m.flush_ns.count, (uint64_t)1);
+        // the first segment and one per 64k
+        EXPECT_EQ(m.rotations, 1 + m.accepted / 65536);
+        EXPECT_EQ(m.rotate_ns.count, m.rotations);
+    }
+    // the flusher thread writes
+    {
+        auto log = Logger<SizeRotate>::of(builder(true));
+        for (int i = 0; i < n; ++i) log->Logf("{}"_fmt, line);
+        log->Flush();
+        auto& m = log->metrics();
+        for (int i = 0; i < 1000 && m.written < n * line.size(); ++i) poll(nullptr, 0, 1);
+        EXPECT_EQ(m.Get().accepted, n * line.size());
+        EXPECT_EQ(m.Get().written, n * line.size());
+    }
+
+    // the workers dump their loggers' metrics
+    const auto stats = "/tmp/metrics_test.stats"s;
+    unlink(stats.c_str());
+    Workers w;
+    w.stats_file = stats;
+    w.stats_interval = 1;
+    EXPECT_TRUE(Workers::Set(w));
+    EXPECT_TRUE(Workers::Snapshot().workers.empty());
+
+    const int fd = 40;
+    dup2(open("/dev/null", O_WRONLY), fd);
+    Logger<SizeRotate>::Redirect(fd, builder(false));
+    for (int i = 0; i < n; ++i) write_all(fd, line);
+    std::string s;
+    for (int i = 0; i < 5000; ++i, poll(nullptr, 0, 1)) {
+        s = slurp(stats);
+        auto l = s.find("logger=/tmp/metrics_test.log ");
+        if (l != std::string::npos &&
+            field(s.substr(l), "accepted") == int64_t(n * line.size())) {
+            break;
+        }
+    }
+    auto l = s.find("logger=/tmp/metrics_test.log ");
+    EXPECT_TRUE(l != std::string::npos);
+    s = s.substr(l, s.find('\n', l) - l);
+    EXPECT_EQ(field(s, "accepted"), int64_t(n * line.size()));
+    EXPECT_TRUE(field(s, "write_ns.p99") >= field(s, "write_ns.p50"));
+    EXPECT_TRUE(field(s, "rotate_ns.max") > 0);
+
+    auto snap = Workers::Snapshot();
+    EXPECT_EQ(snap.workers.size(), (size_t)1);
+    EXPECT_EQ(snap.workers[0].fds, 1);
+    EXPECT_TRUE(snap.workers[0].wakeups > 0);
+    EXPECT_TRUE(snap.workers[0].events.count > 0 && snap.workers[0].events.max <= 8);
+    EXPECT_EQ(snap.loggers.size(), (size_t)1);
+    EXPECT_EQ(snap.loggers[0].first, "/tmp/metrics_test.log"s);
+    unlink(stats.c_str());
+}
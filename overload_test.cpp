@@ -0,0 +1,174 @@
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/poll.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <chrono>
+#include <sstream>
+#include <thread>
+#include "log.h"
+#include "str.h"
+#include "test.h"
+
+static bool write_all(int fd, std::string_view s) {
+    while (!s.empty()) {
+        auto n = write(fd, s.data(), s.size());
+        if (n > 0) {
+            s.remove_prefix(n);
+        } else if (errno == EAGAIN) {
+            pollfd out{fd, POLLOUT, 0};
+            poll(&out, 1, -1);
+        } else if (errno != EINTR) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// the segment is a fifo that the test reads as slowly as it likes
+static int stalled_file(const std::string& path) {
+    unlink(path.c_str());
+    mkfifo(path.c_str(), 0644);
+    return open(path.c_str(), O_RDONLY | O_NONBLOCK);
+}
+
+static std::string read_all(int fd) {
+    std::string r;
+    char buf[65536];
+    for (;;) {
+        auto n = read(fd, buf, sizeof(buf));
+        if (n > 0) {
+            r.append(buf, n);
+        } else if (n == 0) {
+            return r;
+        } else {
+            pollfd in{fd, POLLIN, 0};
+            poll(&in, 1, 100);
+        }
+    }
+}
+
+static std::string line(int i) {
+    auto s = slog::internal::format("#{} "sv, i);
+    s.resize(99, 'x');
+    return s + '\n';
+}
+
+int main() {
+    using namespace slog;
+    const int n = 20000;
+    const int fd = 30;
+    const auto path = "/tmp/overload_test.0.log"s;
+
+    auto run = [&](Overload o, bool slow) {
+        const int in = stalled_file(path);
+        dup2(open("/dev/null", O_WRONLY), fd);
+        SizeRotate::Builder builder;
+        builder.set_size("1g"_b)
+            .set_name("overload_test"s)
+            .set_base("/tmp"s)
+            .set_num_files(1)
+            .set_buf_size("4k"_b)
+            .set_flusher(2)
+            .set_durability(Durability::none)
+            .set_max_line("4k"_b)
+            .set_overload(o, "16k"_b)
+            .set_loss_marker(0);
+        auto policy = builder.Build();
+        Logger<SizeRotate>::Redirect(fd, policy);
+
+        std::thread producer{[&] {
+            for (int i = 0; i < n; ++i) write_all(fd, line(i));
+            // the worker flushes and closes the file at the end of the pipe
+            close(fd);
+        }};
+        if (slow) std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        // anything but block keeps the producer going while nothing is read
+        if (!slow) producer.join();
+        auto out = read_all(in);
+        if (slow) producer.join();
+        close(in);
+        unlink(path.c_str());
+        return std::pair{std::move(out), policy};
+    };
+
+    // checks that the lines are in order, and that what is missing is accounted for
+    auto check = [&](const std::string& out, const RotatePolicy& p, int& kept,
+                     int& last) {
+        std::istringstream ss{out};
+        uint64_t bytes = 0, lines = 0;
+        kept = 0;
+        last = -1;
+        for (std::string s; std::getline(ss, s);) {
+            uint64_t b, l;
+            if (sscanf(s.c_str(), "slog: dropped %lu bytes, %lu lines", &b, &l) == 2) {
+                bytes += b;
+                lines += l;
+                continue;
+            }
+            const int i = atoi(s.c_str() + 1);
+            if (i <= last || s + '\n' != line(i)) return false;
+            last = i;
+            ++kept;
+        }
+        return bytes == p.loss().bytes && lines == p.loss().lines &&
+               bytes == lines * 100 && kept + lines == (uint64_t)n;
+    };
+
+    int kept, last;
+    {
+        auto [out, p] = run(Overload::drop_newest, false);
+        EXPECT_TRUE(check(out, p->policy(), kept, last));
+        EXPECT_TRUE(kept < n);
+    }
+    {
+        auto [out, p] = run(Overload::drop_oldest, false);
+        EXPECT_TRUE(check(out, p->policy(), kept, last));
+        EXPECT_TRUE(kept < n);
+        // the newest data is kept
+        EXPECT_EQ(last, n - 1);
+    }
+    {
+        auto [out, p] = run(Overload::spill, true);
+        EXPECT_TRUE(check(out, p->policy(), kept, last));
+        EXPECT_EQ(kept, n);
+    }
+    {
+        auto [out, p] = run(Overload::block, true);
+        EXPECT_TRUE(check(out, p->policy(), kept, last));
+        EXPECT_EQ(kept, n);
+    }
+
+    // the writes move to a flusher unless the caller chose
+    for (auto [set, bufs] : {std::pair{-1, 4}, {0, 0}, {1, 2}, {8, 8}}) {
+        RotatePolicy::Builder b;
+        b.set_overload(Overload::drop_newest, 4096);
+        if (set >= 0) b.set_flusher(set);
+        EXPECT_EQ(b.Build().options().flush_bufs, bufs);
+    }
+
+    // a queue drops what arrives under either drop policy, and counts it
+    signal(SIGPIPE, SIG_IGN);
+    for (auto o : {Overload::drop_newest, Overload::drop_oldest}) {
+        const auto name = internal::format("overload_queue{}"sv, (int)o);
+        const int in = stalled_file("/tmp/" + name + ".0.log");
+        SizeRotate::Builder b;
+        b.set_size("1g"_b)
+            .set_name(name)
+            .set_base("/tmp"s)
+            .set_num_files(1)
+            .set_buf_size("4k"_b)
+            .set_flusher(2)
+            .set_durability(Durability::none)
+            .set_overload(o, "16k"_b)
+            .set_loss_marker(0);
+        auto q = Logger<SizeRotate>::Async(b.Build(), 64);
+        EXPECT_TRUE(q != nullptr);
+        // the file holds far less than this while nothing is read
+        for (int i = 0; i < n; ++i) q->Log(line(i));
+        EXPECT_TRUE(q->lost().lines > 0);
+        // the worker's writes fail from now on
+        close(in);
+        unlink(("/tmp/" + name + ".0.log").c_str());
+    }
+}
@@ -0,0 +1,102 @@
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <chrono>
+#include <fstream>
+#include <set>
+#include <thread>
+#include <vector>
+#include "log.h"
+#include "str.h"
+#include "test.h"
+
+static void write_all(int fd, std::string_view s) {
+    while (!s.empty()) {
+        auto n = write(fd, s.data(), s.size());
+        if (n > 0) {
+            s.remove_prefix(n);
+        } else if (errno == EAGAIN) {
+            pollfd out{fd, POLLOUT, 0};
+            poll(&out, 1, -1);
+        } else if (errno != EINTR) {
+            return;
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    using namespace slog;
+    const int seconds = argc < 2 ? 4 : atoi(argv[1]);
+    // even fds all hash to the first of two workers
+    const std::vector<int> fds{20, 22, 24, 26};
+    auto path = [](int fd) { return "/tmp/pool_test-" + std::to_string(fd) + ".0.log"; };
+    for (auto fd : fds) unlink(path(fd).c_str());
+
+    if (fork() == 0) {
+        Workers w;
+        w.n = 2;
+        w.rebalance = 1;
+        w.cpus = {0};
+        EXPECT_TRUE(Workers::Set(w));
+        const int null = open("/dev/null", O_WRONLY);
+        for (auto fd : fds) {
+            dup2(null, fd);
+            SizeRotate::Builder builder;
+            builder.set_size("1g"_b)
+                .set_name("pool_test-" + std::to_string(fd))
+                .set_base("/tmp"s)
+                .set_num_files(1)
+                .set_buf_size("64k"_b)
+                .set_prefix("{tid} "s);
+            Logger<SizeRotate>::Redirect(fd, builder.Build());
+        }
+        EXPECT_TRUE(!Workers::Set(w));
+
+        std::vector<std::thread> producers;
+        const auto end = std::chrono::steady_clock::now() + std::chrono::seconds(seconds);
+        for (auto fd : fds) {
+            producers.emplace_back([&, fd] {
+                std::string s;
+                for (int i = 0; std::chrono::steady_clock::now() < end;) {
+                    s.clear();
+                    for (int k = 0; k < 64; ++k, ++i) {
+                        s += internal::format("{} #{} this is a test\n"_fmt, fd, i);
+                    }
+                    write_all(fd, s);
+                    poll(nullptr, 0, 1);
+                }
+            });
+        }
+        for (auto& p : producers) p.join();
+        // the workers read what is left before the process exits
+        for (auto fd : fds) {
+            for (int n = 1; ioctl(fd, FIONREAD, &n) == 0 && n > 0;) poll(nullptr, 0, 1);
+        }
+        exit(0);
+    }
+    int status;
+    wait(&status);
+    EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    // every line in order, written by whichever worker held the fd at the time
+    std::set<int> workers;
+    int moved = 0;
+    for (auto fd : fds) {
+        std::ifstream in{path(fd)};
+        std::set<int> tids;
+        int next = 0;
+        for (std::string s; std::getline(in, s);) {
+            const auto sp = s.find(' ');
+            tids.insert(atoi(s.c_str()));
+            EXPECT_EQ(s.substr(sp + 1),
+                      internal::format("{} #{} this is a test"_fmt, fd, next++));
+        }
+        EXPECT_TRUE(next > 0);
+        workers.insert(tids.begin(), tids.end());
+        moved += tids.size() > 1;
+    }
+    EXPECT_EQ(workers.size(), (size_t)2);
+    EXPECT_TRUE(moved > 0);
+}
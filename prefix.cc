@@ -0,0 +1,90 @@
+#include "prefix.h"
+#include <time.h>
+#include <algorithm>
+#include <cstdlib>
+#include "log.h"
+#include "str.h"
+
+namespace slog::internal {
+
+prefixer::prefixer(std::string_view spec) : ns_{-1}, second_{-1}, tid_{0}, fd_{0} {
+    static const struct {
+        std::string_view name;
+        field::kind k;
+        int digits;
+    } names[] = {
+        {"{utc}", field::utc, 0},
+        {"{utc.ms}", field::utc, 3},
+        {"{utc.us}", field::utc, 6},
+        {"{local}", field::local, 0},
+        {"{local.ms}", field::local, 3},
+        {"{local.us}", field::local, 6},
+        {"{pid}", field::pid, 0},
+        {"{tid}", field::tid, 0},
+        {"{fd}", field::fd, 0},
+    };
+    std::string text;
+    while (!spec.empty()) {
+        auto it = std::find_if(std::begin(names), std::end(names), [&](auto& n) {
+            return spec.substr(0, n.name.size()) == n.name;
+        });
+        if (it == std::end(names)) {
+            text += spec[0];
+            spec.remove_prefix(1);
+            continue;
+        }
+        if (!text.empty()) fields_.push_back({field::text, 0, std::move(text)});
+        text.clear();
+        fields_.push_back({it->k, it->digits, {}});
+        spec.remove_prefix(it->name.size());
+    }
+    if (!text.empty()) fields_.push_back({field::text, 0, std::move(text)});
+}
+
+void prefixer::render(int64_t second, int tid, int fd) {
+    second_ = second;
+    tid_ = tid;
+    fd_ = fd;
+    line_.clear();
+    patches_.clear();
+    const time_t t = second;
+    for (auto& f : fields_) {
+        switch (f.k) {
+            case field::text:
+                line_ += f.literal;
+                break;
+            case field::utc:
+            case field::local: {
+                tm tm;
+                f.k == field::utc ? gmtime_r(&t, &tm) : localtime_r(&t, &tm);
+                line_ += format("{:04}-{:02}-{:02}T{:02}:{:02}:{:02}"_fmt,
+                                tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour,
+                                tm.tm_min, tm.tm_sec);
+                if (f.digits) {
+                    line_ += '.';
+                    patches_.push_back({(uint32_t)line_.size(), f.digits});
+                    line_.append(f.digits, '0');
+                }
+                if (f.k == field::utc) {
+                    line_ += 'Z';
+                } else {
+                    const auto off = tm.tm_gmtoff / 60;
+                    line_ += format("{}{:02}:{:02}"_fmt, off < 0 ? '-' : '+',
+                                    std::abs(off) / 60, std::abs(off) % 60);
+                }
+                break;
+            }
+            case field::pid:
+                line_ += format("{}"_fmt, slog::pid);
+                break;
+            case field::tid:
+                line_ += format("{}"_fmt, tid);
+                break;
+            case field::fd:
+                line_ += fd < 0 ? "-"s : format("{}"_fmt, fd);
+                break;
+        }
+    }
+}
+
+}  // namespace slog::internal
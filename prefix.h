@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace slog::internal {
+
+/*
+   The prefix of each line, from a spec of literal text and fields:
+     {utc} {utc.ms} {utc.us}        ISO-8601 UTC time, e.g. 2024-05-01T08:30:00.123Z
+     {local} {local.ms} {local.us}  local time with its offset, e.g. ...00.123+02:00
+     {pid} {tid} {fd}               process, thread calling Logger::Log, redirected fd
+                                    (- if none)
+   For redirected fds and Async queues that thread is the slog worker writing the
+   line, not the producer. Anything else, including unknown fields, is copied as is.
+   The prefix is rendered only when the second, the thread or the fd changes; in
+   between, a line costs a patch of the sub-second digits.
+ */
+class prefixer {
+    struct field {
+        enum kind : uint8_t { text, utc, local, pid, tid, fd };
+        kind k;
+        int digits;  // sub-second digits of a time
+        std::string literal;
+    };
+    struct patch {
+        uint32_t pos;
+        int digits;
+    };
+    std::vector<field> fields_;
+    std::vector<patch> patches_;
+    std::string line_;
+    int64_t ns_;  // the time `line_` shows
+    int64_t second_;
+    int tid_;
+    int fd_;
+
+    void render(int64_t second, int tid, int fd);
+
+    // the last `n` decimal digits of `v`, two at a time
+    static void put_digits(char* p, uint32_t v, int n) {
+        static constexpr char pairs[] =
+            "00010203040506070809101112131415161718192021222324252627282930313233343536"
+            "37383940414243444546474849505152535455565758596061626364656667686970717273"
+            "7475767778798081828384858687888990919293949596979899";
+        for (p += n; n > 1; n -= 2, v /= 100) memcpy(p -= 2, pairs + v % 100 * 2, 2);
+        if (n) p[-1] = '0' + v;
+    }
+
+   public:
+    explicit prefixer(std::string_view spec);
+
+    // the prefix of a line logged at `ns` by thread `tid` from fd `fd`
+    std::string_view get(int64_t ns, int tid, int fd) {
+        if (ns == ns_ && tid == tid_ && fd == fd_) return line_;
+        const auto second = ns / 1000000000;
+        if (second != second_ || tid != tid_ || fd != fd_) render(second, tid, fd);
+        ns_ = ns;
+        const uint32_t sub = ns - second * 1000000000;
+        for (auto& p : patches_) {
+            const auto v = p.digits == 6 ? sub / 1000 : sub / 1000000;
+            put_digits(&line_[p.pos], v, p.digits);
+        }
+        return line_;
+    }
+};
+
+}  // namespace slog::internal
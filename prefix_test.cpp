@@ -0,0 +1,111 @@
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include "log.h"
+#include "prefix.h"
+#include "str.h"
+#include "test.h"
+
+static std::string slurp(const std::string& path) {
+    std::ifstream f{path};
+    return {std::istreambuf_iterator<char>{f}, {}};
+}
+
+template <typename F>
+static double ns_per_call(int n, F&& f) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < n; ++i) f(i);
+    auto d = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count() / (double)n;
+}
+
+int main(int argc, char* argv[]) {
+    using namespace slog;
+    const int n = argc < 2 ? 2000000 : atoi(argv[1]);
+    const int64_t t = 1714552200123456789;  // 2024-05-01T08:30:00.123456789Z
+    const auto ids = internal::format(" {} {} "_fmt, pid, tid);
+
+    {
+        internal::prefixer p{"{utc.us} {pid} {tid} [{fd}] {x}"};
+        EXPECT_EQ(p.get(t, tid, -1), "2024-05-01T08:30:00.123456Z" + ids + "[-] {x}");
+        // only the digits change within the second
+        EXPECT_EQ(p.get(t + 876543210, tid, 2),
+                  "2024-05-01T08:30:00.999999Z" + ids + "[2] {x}");
+        EXPECT_EQ(p.get(t + 900000000, 7, 2),
+                  "2024-05-01T08:30:01.023456Z " + std::to_string(pid) + " 7 [2] {x}");
+    }
+    {
+        setenv("TZ", "UTC-2", 1);
+        tzset();
+        internal::prefixer p{"{local.ms}|{local}|{utc}"};
+        EXPECT_EQ(p.get(t, tid, -1),
+                  "2024-05-01T10:30:00.123+02:00|2024-05-01T10:30:00+02:00|"
+                  "2024-05-01T08:30:00Z");
+        setenv("TZ", "UTC+5:30", 1);
+        tzset();
+        internal::prefixer q{"{local.ms}"};
+        EXPECT_EQ(q.get(t, tid, -1), "2024-05-01T03:00:00.123-05:30");
+    }
+
+    auto builder = [](std::string name, std::string prefix) {
+        unlink(("/tmp/" + name + ".0.log").c_str());
+        SizeRotate::Builder b;
+        b.set_size("1g"_b)
+            .set_name(std::move(name))
+            .set_base("/tmp"s)
+            .set_num_files(1)
+            .set_buf_size("64k"_b)
+            .set_prefix(std::move(prefix));
+        return b.Build();
+    };
+
+    // a line split across writes gets one prefix
+    {
+        auto log = Logger<SizeRotate>::of(builder("prefix_test", "[{fd}] "));
+        log->Log("a\nb", {0, 2});
+        log->Log("c\n\nd\n", {0, 2});
+        log->Log("e\n", {0});
+        log->Flush();
+    }
+    EXPECT_EQ(slurp("/tmp/prefix_test.0.log"), "[2] a\n[2] bc\n[2] \n[2] d\n[-] e\n");
+
+    // a time and the ids in front of every line
+    {
+        auto log =
+            Logger<SizeRotate>::of(builder("prefix_test", "{utc.ms} {pid} {tid} "));
+        const auto before = current_nanos();
+        log->Log("x\ny\n", {0});
+        log->Flush();
+        const auto s = slurp("/tmp/prefix_test.0.log");
+        EXPECT_EQ(s.size(), 2 * (24 + ids.size() + 2));
+        EXPECT_EQ(s.substr(24, ids.size() + 2), ids + "x\n");
+        EXPECT_EQ(s.substr(0, 24), s.substr(24 + ids.size() + 2, 24));
+        tm tm{};
+        strptime(s.c_str(), "%Y-%m-%dT%H:%M:%S", &tm);
+        const auto ms = timegm(&tm) * 1000 + atoi(s.c_str() + 20);
+        EXPECT_TRUE(ms >= before / 1000000 && ms <= current_nanos() / 1000000);
+    }
+
+    // one line per call, and a redirected read of 64 lines
+    std::string line = "the quick brown fox jumps over the lazy dog\n";
+    std::string chunk;
+    for (int i = 0; i < 64; ++i) chunk += line;
+    double bare, bare_chunked, prefixed, chunked;
+    {
+        auto log = Logger<SizeRotate>::of(builder("prefix_test", ""));
+        bare = ns_per_call(n, [&](int) { log->Log(line, {0}); });
+        bare_chunked = ns_per_call(n / 64, [&](int) { log->Log(chunk, {0}); }) / 64;
+    }
+    {
+        auto log = Logger<SizeRotate>::of(builder("prefix_test", "{local.us} [{fd}] "));
+        prefixed = ns_per_call(n, [&](int) { log->Log(line, {0, 1}); });
+        chunked = ns_per_call(n / 64, [&](int) { log->Log(chunk, {0, 1}); }) / 64;
+    }
+    unlink("/tmp/prefix_test.0.log");
+    std::cout << "Log: " << bare << " ns/line, " << bare_chunked
+              << " ns/line in 64-line writes; with a prefix: " << prefixed << " ns/line, "
+              << chunked << " ns/line in 64-line writes" << std::endl;
+}
@@ -0,0 +1,78 @@
+#include "prepare.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "file.h"
+
+namespace slog {
+
+Preparer::Preparer() : stop_{false} {
+    worker_ = std::thread{[this] { run(); }};
+}
+
+Preparer::~Preparer() {
+    {
+        std::scoped_lock lock{m_};
+        stop_ = true;
+    }
+    cv_.notify_all();
+    worker_.join();
+    if (ready_) discard(*ready_);
+}
+
+void Preparer::discard(segment& s) {
+    close(s.fd);
+    // an unused empty file would look like the latest segment on restart
+    if (s.created) unlink(s.j.path.c_str());
+    if (!s.j.link.empty()) unlink(s.j.link.c_str());
+}
+
+void Preparer::run() {
+    std::unique_lock lock{m_};
+    for (;;) {
+        cv_.wait(lock, [this] { return stop_ || todo_; });
+        if (stop_) return;
+        auto j = std::move(*todo_);
+        todo_.reset();
+        running_ = j.key;
+        auto stale = std::move(ready_);
+        ready_.reset();
+        lock.unlock();
+
+        if (stale) discard(*stale);
+        for (auto& p : j.drop) unlink(p.c_str());
+        struct stat st {};
+        const bool created = !j.append || stat(j.path.c_str(), &st) != 0;
+        int fd = File::Open(j.path.c_str(), j.append, j.read);
+        // blocks only, the file size is left to the writer
+        if (j.reserve > 0) fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, j.reserve);
+        if (!j.link.empty()) {
+            unlink(j.link.c_str());
+            symlink(j.target.c_str(), j.link.c_str());
+        }
+
+        lock.lock();
+        ready_ = segment{std::move(j), fd, created};
+        running_.reset();
+        cv_.notify_all();
+    }
+}
+
+void Preparer::Prepare(job j) {
+    {
+        std::scoped_lock lock{m_};
+        todo_ = std::move(j);
+    }
+    cv_.notify_all();
+}
+
+int Preparer::Take(int64_t key) {
+    std::unique_lock lock{m_};
+    cv_.wait(lock, [&] { return running_ != key && !(todo_ && todo_->key == key); });
+    if (!ready_ || ready_->j.key != key) return -1;
+    const int fd = ready_->fd;
+    ready_.reset();
+    return fd;
+}
+
+}  // namespace slog
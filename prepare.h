@@ -0,0 +1,59 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace slog {
+
+/*
+   Opens the next segment of a rotate policy on a background thread, so rotation on the
+   logging path only swaps the fd and renames a ready symlink into place. A segment is
+   identified by a key, such as its index or start time; a prepared segment that is
+   not taken is discarded.
+ */
+class Preparer {
+   public:
+    struct job {
+        int64_t key;
+        std::string path;
+        std::vector<std::string> drop;  // unlinked first
+        std::string link;  // symlink to `target` created for the rename, may be empty
+        std::string target;
+        bool append;
+        bool read;
+        uint64_t reserve;  // bytes to fallocate, 0 for none
+    };
+
+   private:
+    struct segment {
+        job j;
+        int fd;
+        bool created;
+    };
+
+    std::mutex m_;
+    std::condition_variable cv_;
+    std::optional<job> todo_;
+    std::optional<segment> ready_;
+    std::optional<int64_t> running_;
+    bool stop_;
+    std::thread worker_;
+
+    void run();
+    static void discard(segment& s);
+
+   public:
+    Preparer();
+    ~Preparer();
+
+    // replaces any segment prepared before
+    void Prepare(job j);
+    // the fd prepared for `key`, waits for it if in progress; -1 if there is none
+    int Take(int64_t key);
+};
+
+}  // namespace slog
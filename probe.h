@@ -0,0 +1,91 @@
+#pragma once
+
+#include <type_traits>
+
+/*
+   USDT probes in the format of systemtap's <sys/sdt.h>, for bpftrace and perf:
+
+     SLOG_PROBE(name, args...)  probe slog:name with up to 3 integer or pointer args
+
+   A probe is a nop in the code and an ELF note naming it and telling where its
+   arguments live; a tracer that attaches patches the nop into a trap. Arguments are
+   computed whether or not a tracer is attached, so keep them to values at hand.
+   Defining SLOG_NO_PROBES compiles them out, as do targets other than x86-64 and
+   AArch64 ELF.
+
+   The probes, see bpftrace/ for scripts:
+     buffer_full(fd, n)  a buffer is handed over, a write of n bytes did not fit
+     flush_start(fd)
+     flush_end(fd, ok)
+     rotate_start(key)   key: the segment index, or the start of the time span
+     rotate_end(key)
+     read(fd, n)         what read() or splice() of redirected fd `fd` returned
+     wakeup(n)           what an async worker's epoll_wait() returned
+ */
+
+namespace slog::internal {
+
+// the argument size as the note records it, negative if signed
+template <typename T>
+constexpr int probe_size() {
+    using U = std::decay_t<T>;
+    return std::is_signed_v<U> ? -(int)sizeof(U) : (int)sizeof(U);
+}
+
+template <typename... ARGS>
+int probe_args(const ARGS&...);
+
+}  // namespace slog::internal
+
+#if !defined(SLOG_NO_PROBES) && defined(__ELF__) && \
+    (defined(__x86_64__) || defined(__aarch64__))
+
+#define _SLOG_PROBE_IN(i, x) \
+    [s##i] "n"(slog::internal::probe_size<decltype(x)>()), [a##i] "nor"(x)
+#define _SLOG_PROBE_ARG(i) "%c[s" #i "]@%[a" #i "]"
+
+#define _SLOG_PROBE(name, args, ...)                                            \
+    __asm__ __volatile__(                                                       \
+        "990: nop\n"                                                            \
+        ".pushsection .note.stapsdt,\"?\",\"note\"\n"                           \
+        ".balign 4\n"                                                           \
+        ".4byte 992f-991f, 994f-993f, 3\n"                                      \
+        "991: .asciz \"stapsdt\"\n"                                             \
+        "992: .balign 4\n"                                                      \
+        "993: .8byte 990b\n"                                                    \
+        ".8byte _.stapsdt.base\n"                                               \
+        ".8byte 0\n"                                                            \
+        ".asciz \"slog\"\n"                                                     \
+        ".asciz \"" #name "\"\n"                                                \
+        ".asciz \"" args "\"\n"                                                 \
+        "994: .balign 4\n"                                                      \
+        ".popsection\n"                                                         \
+        ".ifndef _.stapsdt.base\n"                                              \
+        ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n" \
+        ".weak _.stapsdt.base\n"                                                \
+        ".hidden _.stapsdt.base\n"                                              \
+        "_.stapsdt.base: .space 1\n"                                            \
+        ".size _.stapsdt.base, 1\n"                                             \
+        ".popsection\n"                                                         \
+        ".endif\n"                                                              \
+        :                                                                       \
+        : __VA_ARGS__)
+
+#define _SLOG_PROBE0(name) _SLOG_PROBE(name, "", )
+#define _SLOG_PROBE1(name, a) _SLOG_PROBE(name, _SLOG_PROBE_ARG(0), _SLOG_PROBE_IN(0, a))
+#define _SLOG_PROBE2(name, a, b)                                 \
+    _SLOG_PROBE(name, _SLOG_PROBE_ARG(0) " " _SLOG_PROBE_ARG(1), \
+                _SLOG_PROBE_IN(0, a), _SLOG_PROBE_IN(1, b))
+#define _SLOG_PROBE3(name, a, b, c)                                                     \
+    _SLOG_PROBE(name, _SLOG_PROBE_ARG(0) " " _SLOG_PROBE_ARG(1) " " _SLOG_PROBE_ARG(2), \
+                _SLOG_PROBE_IN(0, a), _SLOG_PROBE_IN(1, b), _SLOG_PROBE_IN(2, c))
+
+#define _SLOG_PROBE_N(_0, _1, _2, _3, n, ...) _SLOG_PROBE##n
+#define SLOG_PROBE(...) _SLOG_PROBE_N(__VA_ARGS__, 3, 2, 1, 0, )(__VA_ARGS__)
+
+#else
+
+// the arguments are not evaluated
+#define SLOG_PROBE(name, ...) (void)sizeof(slog::internal::probe_args(__VA_ARGS__))
+
+#endif
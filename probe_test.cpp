@@ -0,0 +1,92 @@
+#include <elf.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <vector>
+#include "log.h"
+#include "probe.h"
+#include "str.h"
+#include "test.h"
+
+static std::string slurp(const std::string& path) {
+    std::ifstream f{path};
+    return {std::istreambuf_iterator<char>{f}, {}};
+}
+
+// the arguments of each slog probe in the executable, as its .note.stapsdt has them
+static std::multimap<std::string, std::string> probes() {
+    std::multimap<std::string, std::string> r;
+    const auto elf = slurp("/proc/self/exe");
+    auto eh = (const Elf64_Ehdr*)elf.data();
+    auto sh = (const Elf64_Shdr*)(elf.data() + eh->e_shoff);
+    const char* names = elf.data() + sh[eh->e_shstrndx].sh_offset;
+    for (int i = 0; i < eh->e_shnum; ++i) {
+        if (strcmp(names + sh[i].sh_name, ".note.stapsdt") != 0) continue;
+        auto p = elf.data() + sh[i].sh_offset, e = p + sh[i].sh_size;
+        while (p < e) {
+            auto n = (const Elf64_Nhdr*)p;
+            auto desc = p + sizeof(*n) + (n->n_namesz + 3) / 4 * 4;
+            // pc, base and semaphore, then provider, name and arguments
+            const char* provider = desc + 24;
+            const char* name = provider + strlen(provider) + 1;
+            const char* args = name + strlen(name) + 1;
+            if (n->n_type == 3 && strcmp(provider, "slog") == 0) r.emplace(name, args);
+            p = desc + (n->n_descsz + 3) / 4 * 4;
+        }
+    }
+    return r;
+}
+
+int main() {
+    using namespace slog;
+
+    long x = 7;
+    unsigned short y = 1;
+    SLOG_PROBE(test0);
+    SLOG_PROBE(test3, x, y, &x);
+
+    const auto r = probes();
+#ifdef SLOG_NO_PROBES
+    EXPECT_TRUE(r.empty());
+#else
+    auto args = [&](const std::string& name) {
+        auto it = r.find(name);
+        return it == r.end() ? "missing"s : it->second;
+    };
+    EXPECT_EQ(args("test0"), "");
+    // signed 8 bytes, unsigned 2 bytes, a pointer
+    std::istringstream ss{args("test3")};
+    std::vector<std::string> a{std::istream_iterator<std::string>{ss}, {}};
+    EXPECT_EQ(a.size(), (size_t)3);
+    EXPECT_TRUE(internal::starts_with(a[0], "-8@"));
+    EXPECT_TRUE(internal::starts_with(a[1], "2@"));
+    EXPECT_TRUE(internal::starts_with(a[2], "8@"));
+    // the number of arguments of each slog probe
+    for (auto [name, n] : {std::pair{"buffer_full"s, 2}, {"flush_start"s, 1},
+                           {"flush_end"s, 2}, {"rotate_start"s, 1}, {"rotate_end"s, 1},
+                           {"read"s, 2}, {"wakeup"s, 1}}) {
+        EXPECT_TRUE(r.count(name) > 0);
+        for (auto [it, end] = r.equal_range(name); it != end; ++it) {
+            EXPECT_EQ((int)std::count(it->second.begin(), it->second.end(), '@'), n);
+        }
+    }
+#endif
+
+    // the probed paths run as usual
+    unlink("/tmp/probe_test.0.log");
+    SizeRotate::Builder b;
+    b.set_size("4k"_b)
+        .set_name("probe_test"s)
+        .set_base("/tmp"s)
+        .set_num_files(1)
+        .set_buf_size("1k"_b);
+    auto log = Logger<SizeRotate>::of(b.Build());
+    const auto line = "the quick brown fox jumps over the lazy dog\n"sv;
+    for (int i = 0; i < 100; ++i) log->Log(line, {0});
+    log->Flush();
+    unlink("/tmp/probe_test.0.log");
+}
@@ -0,0 +1,55 @@
+#include <sys/poll.h>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "log.h"
+#include "str.h"
+
+int main(int argc, char* argv[]) {
+    using namespace slog;
+    const int max_threads =
+        argc < 2 ? std::max(1u, std::thread::hardware_concurrency()) : atoi(argv[1]);
+    const int n = argc < 3 ? 1000000 : atoi(argv[2]);
+
+    SizeRotate::Builder builder;
+    builder.set_size("64m"_b)
+        .set_name("queue"s)
+        .set_base("/tmp"s)
+        .set_num_files(2)
+        .set_buf_size("64k"_b);
+    auto queue = Logger<SizeRotate>::Async(builder.Build(), 1 << 16);
+
+    const auto line = "this is a test: abcd-efg-hi-jk-lmn-opq-rst-uvw-xyz\n"sv;
+    auto ns = [](auto d) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+    };
+    auto run = [&](const char* what, int k, auto&& log) {
+        std::vector<std::thread> producers;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < k; ++i) {
+            producers.emplace_back([&] {
+                for (int j = 0; j < n; ++j) log(j);
+            });
+        }
+        for (auto& t : producers) t.join();
+        auto pushed = std::chrono::steady_clock::now();
+        while (!queue->empty()) poll(nullptr, 0, 1);
+        auto drained = std::chrono::steady_clock::now();
+
+        const double total = (double)k * n;
+        std::cout << internal::format(
+                         "{}, producers: {}, push: {} ns/line ({} Mlines/s), drain: {} ms"sv,
+                         what, k, ns(pushed - start) / total,
+                         total * 1e3 / ns(pushed - start), ns(drained - start) / 1000000)
+                  << std::endl;
+    };
+    for (int k = 1; k <= max_threads; k <<= 1) {
+        run("Log", k, [&](int) { queue->Log(line); });
+        // formatted by the worker
+        run("Logf", k, [&](int j) {
+            queue->Logf("#{} this is a test: {} {:.2f}\n"_fmt, j, line.substr(0, 33),
+                        j * 0.5);
+        });
+    }
+}
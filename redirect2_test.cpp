@@ -5,12 +5,19 @@
 #include "str.h"
 
 int main() {
-    slog::Logger<slog::TimeRotate>::Redirect(STDERR_FILENO, "stderr"s);
+    using namespace slog;
+    TimeRotate::Builder builder;
+    builder.set_span("1h"_s)
+        .set_name("stderr"s)
+        .set_base("."s)
+        .set_buf_size("1k"_b)
+        .set_num_files(6)
+        .set_prefix("{local.ms} {pid} [{fd}] "s);
+    Logger<TimeRotate>::Redirect(STDERR_FILENO, builder.Build());
     const int n = 0x7fff'ffff;
     for (int i = 0; i < n; ++i) {
         std::cout << '#' << i << std::endl;
-        std::cerr << slog::internal::format("{} #{} this is a trivial test\n"sv,
-                                            slog::current_seconds(), i);
+        std::cerr << internal::format("#{} this is a trivial test\n"sv, i);
         poll(nullptr, 0, 500);
     }
 }
@@ -6,6 +6,8 @@
 
 int main(int argc, char* argv[]) {
     std::string_view path, name;
+    bool splice = false;
+    int max_line = 0;
     for (int i = 1; i < argc; ++i) {
         std::string_view t = argv[i];
         if (t == "-p" || t == "--path") {
@@ -14,6 +16,11 @@ int main(int argc, char* argv[]) {
         } else if (t == "-n" || t == "--name") {
             if (++i == argc) break;
             name = argv[i];
+        } else if (t == "-s" || t == "--splice") {
+            splice = true;
+        } else if (t == "-l" || t == "--max-line") {
+            if (++i == argc) break;
+            max_line = atoi(argv[i]);
         }
     }
 
@@ -26,7 +33,10 @@ int main(int argc, char* argv[]) {
         .set_base(std::string{path})
         .set_name(std::string{name})
         .set_buf_size("1k"_b)
-        .set_num_files(3);
+        .set_num_files(3)
+        .set_pipe_size("1m"_b)
+        .set_splice(splice)
+        .set_max_line(max_line);
 
     Logger<SizeRotate>::Redirect(STDOUT_FILENO, builder.Build());
 
@@ -48,9 +58,20 @@ int main(int argc, char* argv[]) {
         }
         if (pfd.revents & POLLIN) {
             auto n = read(pfd.fd, buf, 1024);
-            if (n > 0) {
-                // std::cout.write(buf, n);
-                write(STDOUT_FILENO, buf, n);
+            // stdout is the non-blocking redirect pipe
+            for (auto p = buf; n > 0;) {
+                auto m = write(STDOUT_FILENO, p, n);
+                if (m > 0) {
+                    p += m;
+                    n -= m;
+                } else if (errno == EAGAIN) {
+                    struct pollfd out {
+                        .fd = STDOUT_FILENO, .events = POLLOUT, .revents = 0
+                    };
+                    poll(&out, 1, -1);
+                } else if (errno != EINTR) {
+                    break;
+                }
             }
         }
     }
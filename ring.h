@@ -0,0 +1,131 @@
+#pragma once
+
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace slog::internal {
+
+constexpr size_t cacheline_size = 64;
+
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield" ::: "memory");
+#endif
+}
+
+/*
+   Bounded multi-producer single-consumer ring (after D. Vyukov's bounded queue).
+
+   A record takes one or more consecutive slots. Producers reserve them with a single
+   CAS on tail_ and publish the record by a release store on the first slot, so the
+   consumer never sees a half-written record. A slot is free for position `pos` iff
+   its sequence equals `pos`; the consumer frees slots in order, hence it is enough
+   for a producer to test the last slot of its reservation.
+ */
+class mpsc_ring {
+    struct alignas(cacheline_size) slot {
+        std::atomic<uint64_t> seq;
+        uint32_t size;  // record size, valid in the first slot only
+        uint32_t n;     // slots taken by the record, valid in the first slot only
+        int64_t seconds;
+        uint32_t tag;  // record type, up to the caller
+        char data[4 * cacheline_size - 32];
+    };
+    static_assert(sizeof(slot) == 4 * cacheline_size);
+
+    const uint64_t mask_;
+    std::unique_ptr<slot[]> slots_;
+    alignas(cacheline_size) std::atomic<uint64_t> tail_;
+    alignas(cacheline_size) std::atomic<uint64_t> head_;
+
+   public:
+    static constexpr size_t payload = sizeof(slot::data);
+
+    explicit mpsc_ring(uint64_t capacity /* power of 2 */)
+        : mask_{capacity - 1}, slots_{new slot[capacity]}, tail_{0}, head_{0} {
+        for (uint64_t i = 0; i < capacity; ++i) {
+            slots_[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    auto capacity() const {
+        return mask_ + 1;
+    }
+
+    bool empty() const {
+        return head_.load(std::memory_order_acquire) ==
+               tail_.load(std::memory_order_acquire);
+    }
+
+    // producer side, returns false if the ring is full
+    bool push(std::string_view s, int64_t seconds, uint32_t tag = 0) {
+        const uint64_t k = s.empty() ? 1 : (s.size() + payload - 1) / payload;
+        if (k > capacity()) return false;
+
+        uint64_t t = tail_.load(std::memory_order_relaxed);
+        for (;;) {
+            const uint64_t last = t + k - 1;
+            const uint64_t seq = slots_[last & mask_].seq.load(std::memory_order_acquire);
+            if (seq < last) return false;
+            if (seq > last) {
+                t = tail_.load(std::memory_order_relaxed);
+                continue;
+            }
+            if (tail_.compare_exchange_weak(t, t + k, std::memory_order_relaxed)) break;
+        }
+
+        auto p = s.data();
+        size_t rest = s.size();
+        for (uint64_t i = 0; i < k; ++i) {
+            const auto n = std::min(rest, payload);
+            memcpy(slots_[(t + i) & mask_].data, p, n);
+            p += n;
+            rest -= n;
+        }
+
+        auto& e = slots_[t & mask_];
+        e.size = s.size();
+        e.n = k;
+        e.seconds = seconds;
+        e.tag = tag;
+        e.seq.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer side, `scratch` joins records spanning several slots
+    template <typename F>
+    bool pop(std::string& scratch, F&& f) {
+        const uint64_t h = head_.load(std::memory_order_relaxed);
+        auto& e = slots_[h & mask_];
+        if (e.seq.load(std::memory_order_acquire) != h + 1) return false;
+
+        const uint64_t k = e.n;
+        if (k == 1) {
+            f(std::string_view{e.data, e.size}, e.seconds, e.tag);
+        } else {
+            scratch.clear();
+            size_t rest = e.size;
+            for (uint64_t i = 0; i < k; ++i) {
+                const auto n = std::min(rest, payload);
+                scratch.append(slots_[(h + i) & mask_].data, n);
+                rest -= n;
+            }
+            f(std::string_view{scratch}, e.seconds, e.tag);
+        }
+
+        for (uint64_t i = 0; i < k; ++i) {
+            slots_[(h + i) & mask_].seq.store(h + i + capacity(), std::memory_order_release);
+        }
+        head_.store(h + k, std::memory_order_release);
+        return true;
+    }
+};
+
+}  // namespace slog::internal
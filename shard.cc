@@ -0,0 +1,296 @@
+#include "shard.h"
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef SLOG_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include "compress.h"
+#include "iter.h"
+
+namespace slog {
+
+namespace {
+
+std::atomic<uint64_t> next_id{1};
+
+// the leading "<seconds>.<nanoseconds> " of `s` in nanoseconds, -1 if none
+int64_t stamp(std::string_view s) {
+    auto digit = [&](size_t i) { return i < s.size() && s[i] >= '0' && s[i] <= '9'; };
+    size_t i = 0;
+    int64_t seconds = 0;
+    for (; digit(i) && i < 12; ++i) seconds = seconds * 10 + (s[i] - '0');
+    if (i == 0 || i + 10 >= s.size() || s[i] != '.' || s[i + 10] != ' ') return -1;
+    int64_t ns = 0;
+    for (size_t j = i + 1; j < i + 10; ++j) {
+        if (!digit(j)) return -1;
+        ns = ns * 10 + (s[j] - '0');
+    }
+    return seconds * 1000000000 + ns;
+}
+
+// lines of a segment, plain or, with zlib, compressed
+class line_reader {
+    static constexpr size_t size = 64 * 1024;
+#ifdef SLOG_HAVE_ZLIB
+    gzFile z_;
+#else
+    int fd_;
+#endif
+    std::unique_ptr<char[]> buf_;
+    size_t b_, e_;
+
+    bool fill() {
+#ifdef SLOG_HAVE_ZLIB
+        const int n = z_ ? gzread(z_, buf_.get(), size) : -1;
+#else
+        const ssize_t n = fd_ >= 0 ? read(fd_, buf_.get(), size) : -1;
+#endif
+        b_ = 0;
+        e_ = n > 0 ? n : 0;
+        return n > 0;
+    }
+
+   public:
+    explicit line_reader(const std::string& path) : buf_{new char[size]}, b_{0}, e_{0} {
+#ifdef SLOG_HAVE_ZLIB
+        // reads plain segments as they are
+        z_ = gzopen(path.c_str(), "rb");
+#else
+        fd_ = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+#endif
+    }
+    ~line_reader() {
+#ifdef SLOG_HAVE_ZLIB
+        if (z_) gzclose(z_);
+#else
+        if (fd_ >= 0) close(fd_);
+#endif
+    }
+
+    // appends the next line to `out`, with a newline even at the end of the segment
+    bool getline(std::string& out) {
+        bool any = false;
+        for (;;) {
+            if (b_ == e_ && !fill()) {
+                if (any) out += '\n';
+                return any;
+            }
+            auto p = buf_.get();
+            auto nl = (const char*)memchr(p + b_, '\n', e_ - b_);
+            const size_t end = nl ? nl - p + 1 : e_;
+            out.append(p + b_, end - b_);
+            b_ = end;
+            any = true;
+            if (nl) return true;
+        }
+    }
+};
+
+}  // namespace
+
+struct Sharded::shard_set {
+    std::mutex m;
+    std::vector<std::shared_ptr<Logger<SizeRotate>>> loggers;
+};
+
+struct Sharded::owned {
+    struct shard {
+        uint64_t id;
+        std::weak_ptr<shard_set> set;
+        Logger<SizeRotate>* logger;
+    };
+    std::vector<shard> v;
+
+    // closes the shards whose Sharded is still alive
+    ~owned() {
+        last_id_ = 0;
+        for (auto& e : v) {
+            auto set = e.set.lock();
+            if (!set) continue;
+            std::shared_ptr<Logger<SizeRotate>> l;  // closed once unlocked
+            std::scoped_lock lock{set->m};
+            auto& ls = set->loggers;
+            auto it = std::find_if(ls.begin(), ls.end(),
+                                   [&](auto& p) { return p.get() == e.logger; });
+            if (it == ls.end()) continue;
+            l = std::move(*it);
+            *it = std::move(ls.back());
+            ls.pop_back();
+        }
+    }
+};
+
+thread_local Sharded::owned Sharded::owned_;
+
+Sharded::Sharded(std::string name, SizeRotate::Builder builder)
+    : id_{next_id.fetch_add(1, std::memory_order_relaxed)},
+      name_{std::move(name)},
+      builder_{std::move(builder)},
+      shards_{std::make_shared<shard_set>()} {}
+
+Logger<SizeRotate>& Sharded::open() {
+    auto& v = owned_.v;
+    // forget the shards of Sharded released since
+    v.erase(std::remove_if(v.begin(), v.end(), [](auto& e) { return e.set.expired(); }),
+            v.end());
+    auto it = std::find_if(v.begin(), v.end(), [this](auto& e) { return e.id == id_; });
+    if (it == v.end()) {
+        auto b = builder_;
+        b.set_name(internal::format("{}-{}"_fmt, name_, tid));
+        auto l = Logger<SizeRotate>::of(b.Build());
+        v.push_back({id_, shards_, l.get()});
+        std::scoped_lock lock{shards_->m};
+        shards_->loggers.push_back(std::move(l));
+        it = v.end() - 1;
+    }
+    last_id_ = id_;
+    last_ = it->logger;
+    return *last_;
+}
+
+void Sharded::Log(std::string_view s) {
+    const auto ns = current_nanos();
+    local().Logf("{}.{:09} {}"_fmt, ns / 1000000000, ns % 1000000000, s);
+}
+
+void Sharded::Flush() {
+    local().Flush();
+}
+
+std::shared_ptr<Sharded> Sharded::Builder::Build() {
+    return std::make_shared<trampoline<Sharded>>(name_, *this);
+}
+
+class Merger::cursor {
+    std::vector<std::string> segments_;  // oldest first
+    size_t next_;
+    std::unique_ptr<line_reader> r_;
+    std::string head_;  // first line of the next record
+
+    bool line(std::string& s) {
+        for (;;) {
+            if (!r_) {
+                if (next_ == segments_.size()) return false;
+                r_ = std::make_unique<line_reader>(segments_[next_++]);
+            }
+            s.clear();
+            if (r_->getline(s)) return true;
+            r_.reset();
+        }
+    }
+
+   public:
+    int64_t time;
+    std::string record;
+
+    explicit cursor(std::vector<std::string> segments)
+        : segments_{std::move(segments)}, next_{0}, time{0} {
+        // records never span segments, the first line tells the segment's age
+        std::vector<std::pair<int64_t, std::string>> v;
+        for (auto& p : segments_) {
+            std::string s;
+            line_reader{p}.getline(s);
+            v.emplace_back(stamp(s), std::move(p));
+        }
+        std::sort(v.begin(), v.end());
+        for (size_t i = 0; i < v.size(); ++i) segments_[i] = std::move(v[i].second);
+    }
+
+    // loads the next record, false at the end of the shard
+    bool advance() {
+        if (head_.empty() && !line(head_)) return false;
+        // a shard may start with the tail of an untimed record
+        if (auto t = stamp(head_); t >= 0) time = t;
+        record.swap(head_);
+        head_.clear();
+        for (std::string s; line(s);) {
+            if (stamp(s) >= 0) {
+                head_.swap(s);
+                break;
+            }
+            record += s;
+        }
+        return true;
+    }
+};
+
+Merger::Merger(std::vector<std::vector<std::string>> shards) {
+    for (auto& v : shards) {
+        cursors_.push_back(std::make_unique<cursor>(std::move(v)));
+        if (cursors_.back()->advance()) heap_.push_back(cursors_.size() - 1);
+    }
+    std::make_heap(heap_.begin(), heap_.end(), [this](int a, int b) {
+        return std::pair{cursors_[a]->time, a} > std::pair{cursors_[b]->time, b};
+    });
+}
+
+Merger::~Merger() = default;
+
+bool Merger::Next(std::string& record) {
+    if (heap_.empty()) return false;
+    auto later = [this](int a, int b) {
+        return std::pair{cursors_[a]->time, a} > std::pair{cursors_[b]->time, b};
+    };
+    std::pop_heap(heap_.begin(), heap_.end(), later);
+    auto& c = *cursors_[heap_.back()];
+    record.swap(c.record);
+    if (c.advance()) {
+        std::push_heap(heap_.begin(), heap_.end(), later);
+    } else {
+        heap_.pop_back();
+    }
+    return true;
+}
+
+std::vector<std::vector<std::string>> Merger::Shards(const std::string& base,
+                                                     const std::string& name,
+                                                     const std::string& ext) {
+    // tid -> index -> file name, a plain segment wins over its compressed copy
+    std::map<std::string, std::map<int, std::string>> m;
+    internal::iter(
+        base,
+        [&](auto e) -> int {
+            if (e->d_type != DT_REG) return 0;
+            std::string_view s{e->d_name};
+            const std::string_view file = s;
+            if (!internal::starts_with(s, name) || s.size() <= name.size() ||
+                s[name.size()] != '-') {
+                return 0;
+            }
+            s.remove_prefix(name.size() + 1);
+            const bool compressed = internal::ends_with(s, Compressor::ext);
+            if (compressed) s.remove_suffix(Compressor::ext.size());
+            if (!internal::ends_with(s, "." + ext)) return 0;
+            s.remove_suffix(ext.size() + 1);
+            // <tid>.<index>
+            const auto dot = s.find('.');
+            if (dot == 0 || dot == s.npos || dot + 1 == s.size()) return 0;
+            auto digits = [](std::string_view t) {
+                return std::all_of(t.begin(), t.end(),
+                                   [](char c) { return c >= '0' && c <= '9'; });
+            };
+            if (!digits(s.substr(0, dot)) || !digits(s.substr(dot + 1))) return 0;
+            auto& f = m[std::string{s.substr(0, dot)}][atoi(s.data() + dot + 1)];
+            if (f.empty() || !compressed) f = file;
+            return 0;
+        },
+        [](auto& p) {
+            std::cerr << internal::format("opendir {} failed: {}"sv, p, strerror(errno))
+                      << std::endl;
+        });
+
+    std::vector<std::vector<std::string>> r;
+    for (auto& [tid, segments] : m) {
+        auto& v = r.emplace_back();
+        for (auto& [i, f] : segments) v.push_back(base + '/' + f);
+    }
+    return r;
+}
+
+}  // namespace slog
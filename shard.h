@@ -0,0 +1,82 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "log.h"
+
+namespace slog {
+
+/*
+   Per-thread segment streams: each thread logs to a SizeRotate of its own, named
+   `<name>-<tid>`, so appends take no lock and share no state. Every record starts
+   with its event time, "<seconds>.<nanoseconds> ", the order Merger reads them back
+   in. A thread's shard is flushed and closed when the thread exits, or with the
+   Sharded if that goes first.
+ */
+class Sharded {
+    struct shard_set;
+    struct owned;
+
+    const uint64_t id_;
+    const std::string name_;
+    SizeRotate::Builder builder_;
+    const std::shared_ptr<shard_set> shards_;  // of every thread
+
+    // the calling thread's shards, and its shard of the last Sharded it used
+    static thread_local owned owned_;
+    static inline thread_local uint64_t last_id_ = 0;
+    static inline thread_local Logger<SizeRotate>* last_ = nullptr;
+
+    Sharded(std::string name, SizeRotate::Builder builder);
+    friend class trampoline<Sharded>;
+
+    Logger<SizeRotate>& local() {
+        return last_id_ == id_ ? *last_ : open();
+    }
+    Logger<SizeRotate>& open();
+
+   public:
+    template <typename FMT, typename... ARGS>
+    void Logf(FMT fmt, const ARGS&... args) {
+        const auto ns = current_nanos();
+        local().Logf(internal::concat("{}.{:09} "_fmt, fmt), ns / 1000000000,
+                     ns % 1000000000, args...);
+    }
+    void Log(std::string_view s);
+    // flushes the calling thread's shard
+    void Flush();
+
+    class Builder : public SizeRotate::Builder {
+       public:
+        std::shared_ptr<Sharded> Build();
+    };
+};
+
+/*
+   Timestamp-ordered k-way merge of the shards of a Sharded log. Each shard is read
+   segment by segment, oldest first, so memory stays bounded by a read buffer and one
+   pending record per shard. A line without a leading time belongs to the record
+   above it; records with the same time keep the shard order.
+ */
+class Merger {
+    class cursor;
+
+    std::vector<std::unique_ptr<cursor>> cursors_;
+    std::vector<int> heap_;  // live cursors
+
+   public:
+    // the segments of each shard, in any order
+    explicit Merger(std::vector<std::vector<std::string>> shards);
+    ~Merger();
+
+    // the next record, with its trailing newline; false once every shard is drained
+    bool Next(std::string& record);
+
+    // the segments of the shards of `name` under `base`, one list per shard
+    static std::vector<std::vector<std::string>> Shards(const std::string& base,
+                                                        const std::string& name,
+                                                        const std::string& ext = "log"s);
+};
+
+}  // namespace slog
@@ -0,0 +1,100 @@
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "shard.h"
+#include "str.h"
+#include "test.h"
+
+int main(int argc, char* argv[]) {
+    using namespace slog;
+    const int n = argc < 2 ? 20000 : atoi(argv[1]);
+    const int k = 4;
+
+    for (auto& v : Merger::Shards("/tmp"s, "shard_test"s)) {
+        for (auto& p : v) unlink(p.c_str());
+    }
+    {
+        Sharded::Builder builder;
+        builder.set_size("64k"_b)
+            .set_name("shard_test"s)
+            .set_base("/tmp"s)
+            .set_num_files(100)
+            .set_buf_size("4k"_b);
+        auto log = builder.Build();
+        std::vector<std::thread> producers;
+        for (int t = 0; t < k; ++t) {
+            producers.emplace_back([&, t] {
+                for (int i = 0; i < n; ++i) {
+                    if (i % 100 == 0) {
+                        // continued on a line without a time
+                        log->Logf("{} #{} begin\n{} #{} end\n"_fmt, t, i, t, i);
+                    } else {
+                        log->Logf("{} #{} this is a test\n"_fmt, t, i);
+                    }
+                }
+            });
+        }
+        // the shards are closed as the threads exit
+        for (auto& p : producers) p.join();
+    }
+
+    auto shards = Merger::Shards("/tmp"s, "shard_test"s);
+    EXPECT_EQ(shards.size(), (size_t)k);
+    for (auto& v : shards) EXPECT_TRUE(v.size() > 1);
+
+    Merger m{std::move(shards)};
+    std::vector<int> next(k);
+    int64_t last = 0;
+    for (std::string s; m.Next(s);) {
+        // "<seconds>.<nanoseconds> <t> #<i> ..."
+        const auto sp = s.find(' ');
+        EXPECT_TRUE(sp == 20 && s[10] == '.');
+        const int64_t time = atoll(s.c_str()) * 1000000000 + atoll(s.c_str() + 11);
+        EXPECT_TRUE(time >= last);
+        last = time;
+        const int t = atoi(s.c_str() + sp + 1);
+        EXPECT_TRUE(t >= 0 && t < k);
+        const int i = next[t]++;
+        const auto body = s.substr(sp + 1);
+        if (i % 100 == 0) {
+            EXPECT_EQ(body,
+                      internal::format("{} #{} begin\n{} #{} end\n"_fmt, t, i, t, i));
+        } else {
+            EXPECT_EQ(body, internal::format("{} #{} this is a test\n"_fmt, t, i));
+        }
+    }
+    for (int t = 0; t < k; ++t) EXPECT_EQ(next[t], n);
+
+    // the shards are closed with the Sharded while their threads live on
+    {
+        for (auto& v : Merger::Shards("/tmp"s, "shard_live"s)) {
+            for (auto& p : v) unlink(p.c_str());
+        }
+        Sharded::Builder builder;
+        builder.set_size("64k"_b)
+            .set_name("shard_live"s)
+            .set_base("/tmp"s)
+            .set_num_files(100)
+            .set_buf_size("4k"_b);
+        auto log = builder.Build();
+        std::atomic<int> logged{0};
+        std::atomic<bool> done{false};
+        std::vector<std::thread> producers;
+        for (int t = 0; t < k; ++t) {
+            producers.emplace_back([&, t] {
+                for (int i = 0; i < 100; ++i) log->Logf("{} #{}\n"_fmt, t, i);
+                ++logged;
+                while (!done) usleep(1000);
+            });
+        }
+        while (logged < k) usleep(1000);
+        log.reset();
+        Merger live{Merger::Shards("/tmp"s, "shard_live"s)};
+        int records = 0;
+        for (std::string s; live.Next(s);) ++records;
+        EXPECT_EQ(records, k * 100);
+        done = true;
+        for (auto& p : producers) p.join();
+    }
+}
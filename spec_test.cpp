@@ -0,0 +1,66 @@
+#include <chrono>
+#include <iomanip>
+#include <sstream>
+#include "str.h"
+#include "test.h"
+
+template <typename F>
+static double bench(int n, F&& f) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < n; ++i) f(i);
+    auto d = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count() / (double)n;
+}
+
+int main(int argc, char* argv[]) {
+    using namespace slog;
+    using namespace slog::internal;
+
+    EXPECT_EQ(format("{:08x}"_fmt, 0xbeef), "0000beef"sv);
+    EXPECT_EQ(format("{:#010x}"_fmt, 0xbeef), "0x0000beef"sv);
+    EXPECT_EQ(format("{:X}"_fmt, 255u), "FF"sv);
+    EXPECT_EQ(format("{:05}"_fmt, -42), "-0042"sv);
+    EXPECT_EQ(format("{:+}"_fmt, 42), "+42"sv);
+    EXPECT_EQ(format("{:b}"_fmt, 5), "101"sv);
+    EXPECT_EQ(format("[{:>6}]"_fmt, "ab"), "[    ab]"sv);
+    EXPECT_EQ(format("[{:6}]"_fmt, "ab"), "[ab    ]"sv);
+    EXPECT_EQ(format("[{:*^7}]"_fmt, "ab"), "[**ab***]"sv);
+    EXPECT_EQ(format("[{:6}]"_fmt, 42), "[    42]"sv);
+    EXPECT_EQ(format("[{:<6}]"_fmt, 42), "[42    ]"sv);
+    EXPECT_EQ(format("{:.2}"_fmt, "abcd"), "ab"sv);
+    EXPECT_EQ(format("{:.3f}"_fmt, 3.14159), "3.142"sv);
+    EXPECT_EQ(format("{:8.2f}"_fmt, -2.5), "   -2.50"sv);
+    EXPECT_EQ(format("{:.2e}"_fmt, 12345.0), "1.23e+04"sv);
+    EXPECT_EQ(format("{:p}"_fmt, (void*)0x1234), "0x1234"sv);
+    EXPECT_EQ(format("{:>4}"_fmt, 'c'), "   c"sv);
+    // runtime formats share the parser
+    EXPECT_EQ(format("{:08x} {:>4}"sv, 0xbeef, 1), "0000beef    1"sv);
+
+    // against the ostringstream workaround
+    const int n = argc < 2 ? 200000 : atoi(argv[1]);
+    char buf[256];
+    size_t sink{};
+    auto slow = bench(n, [&](int i) {
+        std::ostringstream ss;
+        ss << std::hex << std::setw(8) << std::setfill('0') << i << ' ' << std::dec
+           << std::setfill(' ') << std::setw(12) << i << ' ' << std::fixed
+           << std::setprecision(3) << i * 0.001;
+        auto s = format("id {} took {}"_fmt, ss.str(), i);
+        sink += s.size();
+    });
+    auto fast = bench(n, [&](int i) {
+        sink += format_to(buf, sizeof(buf), "id {:08x} {:>12} {:.3f} took {}"_fmt, i, i,
+                          i * 0.001, i);
+    });
+
+    std::ostringstream ss;
+    ss << std::hex << std::setw(8) << std::setfill('0') << 1234 << ' ' << std::dec
+       << std::setfill(' ') << std::setw(12) << 1234 << ' ' << std::fixed
+       << std::setprecision(3) << 1234 * 0.001;
+    format_to(buf, sizeof(buf), "{:08x} {:>12} {:.3f}"_fmt, 1234, 1234, 1234 * 0.001);
+    EXPECT_EQ(std::string_view(buf, ss.str().size()), ss.str());
+
+    std::cout << format("ostringstream: {:.1f} ns, spec: {:.1f} ns ({} bytes)"_fmt, slow,
+                        fast, sink)
+              << std::endl;
+}
@@ -1,5 +1,7 @@
 #include "str.h"
 #include <string.h>
+#include <algorithm>
+#include <mutex>
 
 namespace slog::internal {
 
@@ -22,100 +24,217 @@ bool contains(std::string_view s, std::string_view sub) {
     return memmem(s.data(), s.size(), sub.data(), sub.size()) != nullptr;
 }
 
-template <typename ON_ESCAPE, typename ON_SLOT>
-static void parse(std::string_view s, ON_ESCAPE&& on_escape, ON_SLOT&& on_slot) {
-    const int n = s.size();
-    int lstate, rstate;
-    lstate = rstate = -1;
-
-    auto forward = [&](int& state, int cur, auto&& op) -> bool {
-        if (state == -1) {
-            state = cur;
-            op();
-            return true;
-        }
-        if (state + 1 != cur) {
-            // invalid format
-            return false;
-        }
-        on_escape(state, cur);
-        state = -1;
-        return true;
-    };
-
-    for (int i = 0; i < n; ++i) {
-        auto c = s[i];
-        if (c == '{') {
-            if (!forward(lstate, i, [] {})) break;
-        } else if (c == '}') {
-            if (!forward(rstate, i, [&] {
-                    if (lstate != -1) {
-                        on_slot(lstate, rstate);
-                        lstate = rstate = -1;
-                    }
-                }))
-                break;
-        }
-    }
-}
-
 fmt_parser::fmt_parser(std::string_view s) : s_{s} {
     spans_.reserve(8);
-    parse(
+    parse_fmt(
         s_,
         [&](int l, int r) {
-            spans_.push_back({l, r});
+            spans_.push_back({l, r, {}});
         },
         [&](int l, int r) {
             // FIXME: test position
             slots_.set(spans_.size());
-            spans_.push_back({l, r});
+            spans_.push_back({l, r, parse_spec(s_.substr(l + 1, r - l - 1))});
         });
 }
 
-std::string fmt_parser::apply(std::vector<std::string_view> args) const {
-    const int n = spans_.size();
+void render(fmt_out& o, std::string_view s, const fmt_span* spans, int n,
+            std::bitset<64> slots, const fmt_arg* args, int nargs) {
     int p{};
-    std::ostringstream ss;
-
-    args.resize(slots_.count());
-    auto it = args.begin();
+    auto e = args + nargs;
 
     for (int i = 0; i < n; ++i) {
-        ss << s_.substr(p, spans_[i].l - p);
-        if (slots_.test(i)) {
-            ss << *it++;
+        o.put(s.substr(p, spans[i].l - p));
+        if (slots.test(i)) {
+            // missing arguments render empty
+            if (args != e) {
+                args->put(o, args->p, spans[i].spec);
+                ++args;
+            }
         } else {
-            ss << s_[spans_[i].l];
+            o.put(s[spans[i].l]);
         }
-        p = spans_[i].r + 1;
+        p = spans[i].r + 1;
     }
 
-    ss << s_.substr(p);
-    return ss.str();
+    o.put(s.substr(p));
 }
 
-fmt_parser* parser_cache::get(std::string_view fmt) {
-    std::shared_ptr<fmt_parser> p;
-    {
-        std::shared_lock<std::shared_mutex> lock{m};
-        auto it = parser_map.find(fmt);
-        if (it != parser_map.end()) {
-            p = it->second;
-        }
+void put_padded(fmt_out& o, const fmt_spec& sp, std::string_view head,
+                std::string_view body, char align) {
+    const int n = head.size() + body.size();
+    if (n >= sp.width) {
+        o.put(head);
+        o.put(body);
+        return;
+    }
+
+    int pad = sp.width - n;
+    auto fill = [&](int k) {
+        while (k-- > 0) o.put(sp.fill);
+    };
+    if (sp.zero && !sp.align) {
+        o.put(head);
+        while (pad-- > 0) o.put('0');
+        o.put(body);
+        return;
+    }
+    switch (sp.align ? sp.align : align) {
+        case '<':
+            break;
+        case '^':
+            fill(pad / 2);
+            pad -= pad / 2;
+            break;
+        default:
+            fill(pad);
+            pad = 0;
+            break;
+    }
+    o.put(head);
+    o.put(body);
+    fill(pad);
+}
+
+void fmt_parser::apply(fmt_out& o, const fmt_arg* args, int nargs) const {
+    render(o, s_, spans_.data(), spans_.size(), slots_, args, nargs);
+}
+
+struct parser_cache::reader {
+    static constexpr int front_capacity = 16;
+
+    parser_cache& cache;
+    std::atomic<uint64_t> epoch{0};  // 0 if outside of the cache
+    std::atomic<uint64_t> hits{0}, misses{0};
+    uint64_t evictions{0};
+    struct {
+        uint64_t hash;
+        entry* e;
+    } front[front_capacity]{};
+
+    explicit reader(parser_cache& c) : cache{c} {
+        std::scoped_lock lock{cache.m_};
+        cache.readers_.push_back(this);
+    }
+    ~reader() {
+        std::scoped_lock lock{cache.m_};
+        auto& v = cache.readers_;
+        v.erase(std::find(v.begin(), v.end(), this));
+        cache.hits_ += hits.load(std::memory_order_relaxed);
+        cache.misses_ += misses.load(std::memory_order_relaxed);
+    }
+
+    // owner-only increment, still readable by snapshot()
+    static void bump(std::atomic<uint64_t>& n) {
+        n.store(n.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+};
+
+parser_cache::parser_cache()
+    : slots_{}, epoch_{1}, evictions_{0}, victim_{0}, hits_{0}, misses_{0} {}
+
+parser_cache::~parser_cache() {
+    for (auto& e : slots_) delete e.load(std::memory_order_relaxed);
+    for (auto& [_, e] : retired_) delete e;
+}
+
+auto parser_cache::local() -> reader& {
+    thread_local reader r{*this};
+    return r;
+}
+
+auto parser_cache::find(uint64_t h, std::string_view fmt) const -> entry* {
+    for (int i = 0; i < probes; ++i) {
+        auto e = slots_[(h + i) % capacity].load(std::memory_order_acquire);
+        if (e && e->hash == h && e->key == fmt) return e;
     }
-    if (!p) {
-        p = std::make_shared<fmt_parser>(fmt);
-        auto k = h.hold(std::string{fmt});
-        {
-            std::unique_lock<std::shared_mutex> lock{m};
-            parser_map.emplace(*k, p);
+    return nullptr;
+}
+
+auto parser_cache::insert(uint64_t h, std::string_view fmt) -> entry* {
+    std::scoped_lock lock{m_};
+    if (auto e = find(h, fmt)) return e;
+
+    auto e = new entry{h, fmt};
+    for (int i = 0; i < probes; ++i) {
+        auto& slot = slots_[(h + i) % capacity];
+        if (!slot.load(std::memory_order_relaxed)) {
+            slot.store(e, std::memory_order_release);
+            return e;
         }
     }
-    return p.get();
+
+    // the window is full, skip recently used entries once
+    std::atomic<entry*>* slot;
+    for (;;) {
+        slot = &slots_[(h + victim_++ % probes) % capacity];
+        auto v = slot->load(std::memory_order_relaxed);
+        if (!v->used.load(std::memory_order_relaxed)) break;
+        v->used.store(false, std::memory_order_relaxed);
+    }
+    retired_.push_back({epoch_.load(), slot->exchange(e)});
+    evictions_.fetch_add(1);
+    epoch_.fetch_add(1);
+    reclaim();
+    return e;
+}
+
+void parser_cache::reclaim() {
+    uint64_t min = UINT64_MAX;
+    for (auto r : readers_) {
+        if (auto t = r->epoch.load(); t != 0 && t < min) min = t;
+    }
+    auto it = std::remove_if(retired_.begin(), retired_.end(), [=](auto& p) {
+        if (p.first >= min) return false;
+        delete p.second;
+        return true;
+    });
+    retired_.erase(it, retired_.end());
+}
+
+void parser_cache::apply(std::string_view fmt, fmt_out& o, const fmt_arg* args,
+                         int nargs) {
+    auto& r = local();
+    const uint64_t h = std::hash<std::string_view>{}(fmt);
+
+    r.epoch.store(epoch_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    // front entries may have been evicted and released
+    if (auto n = evictions_.load(); n != r.evictions) {
+        for (auto& f : r.front) f = {};
+        r.evictions = n;
+    }
+
+    auto& f = r.front[h % reader::front_capacity];
+    entry* e = f.e;
+    if (e && f.hash == h && e->key == fmt) {
+        reader::bump(r.hits);
+    } else if ((e = find(h, fmt))) {
+        reader::bump(r.hits);
+        f = {h, e};
+    } else {
+        reader::bump(r.misses);
+        e = insert(h, fmt);
+    }
+
+    if (!e->used.load(std::memory_order_relaxed)) {
+        e->used.store(true, std::memory_order_relaxed);
+    }
+    e->parser.apply(o, args, nargs);
+    r.epoch.store(0, std::memory_order_release);
+}
+
+auto parser_cache::snapshot() -> stats {
+    std::scoped_lock lock{m_};
+    stats s{hits_, misses_, evictions_.load(std::memory_order_relaxed)};
+    for (auto r : readers_) {
+        s.hits += r->hits.load(std::memory_order_relaxed);
+        s.misses += r->misses.load(std::memory_order_relaxed);
+    }
+    return s;
 }
 
-thread_local str_holder args_holder;
 parser_cache cache;
 
 }  // namespace slog::internal
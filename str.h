@@ -1,12 +1,16 @@
 #pragma once
 
+#include <string.h>
+#include <algorithm>
+#include <atomic>
 #include <bitset>
-#include <deque>
-#include <map>
+#include <charconv>
+#include <cstdint>
 #include <memory>
-#include <shared_mutex>
-#include <sstream>
+#include <ostream>
+#include <mutex>
 #include <string>
+#include <type_traits>
 #include <vector>
 
 using namespace std::literals;
@@ -17,105 +21,519 @@ bool starts_with(std::string_view s, std::string_view prefix);
 bool ends_with(std::string_view s, std::string_view suffix);
 bool contains(std::string_view s, std::string_view sub);
 
-class fmt_parser {
-    struct span {
-        int l, r;
+template <typename ON_ESCAPE, typename ON_SLOT>
+constexpr void parse_fmt(std::string_view s, ON_ESCAPE&& on_escape, ON_SLOT&& on_slot) {
+    const int n = s.size();
+    int lstate = -1, rstate = -1;
+
+    auto forward = [&](int& state, int cur, auto&& op) -> bool {
+        if (state == -1) {
+            state = cur;
+            op();
+            return true;
+        }
+        if (state + 1 != cur) {
+            // invalid format
+            return false;
+        }
+        on_escape(state, cur);
+        state = -1;
+        return true;
     };
-    std::string_view s_;
-    std::bitset<64> slots_;
-    std::vector<span> spans_;
 
-   public:
-    fmt_parser(std::string_view s);
-    std::string apply(std::vector<std::string_view> args) const;
+    for (int i = 0; i < n; ++i) {
+        auto c = s[i];
+        if (c == '{') {
+            if (!forward(lstate, i, [] {})) break;
+        } else if (c == '}') {
+            if (!forward(rstate, i, [&] {
+                    if (lstate != -1) {
+                        on_slot(lstate, rstate);
+                        lstate = rstate = -1;
+                    }
+                }))
+                break;
+        }
+    }
+}
+
+// [[fill]align][+][#][0][width][.precision][type], after the ':' of a slot
+struct fmt_spec {
+    char fill = ' ';
+    char align = 0;  // '<', '>', '^' or the type's default
+    bool plus = false;
+    bool alt = false;
+    bool zero = false;
+    int width = 0;
+    int precision = -1;
+    char type = 0;
+
+    constexpr bool trivial() const {
+        return !align && !plus && !alt && !zero && !width && precision < 0 && !type;
+    }
 };
 
-template <typename T>
-class holder {
-    std::deque<T> storage_;
+constexpr fmt_spec parse_spec(std::string_view s /* slot without braces */) {
+    fmt_spec r{};
+    if (s.empty() || s[0] != ':') return r;
+    s.remove_prefix(1);
+
+    auto is_align = [](char c) { return c == '<' || c == '>' || c == '^'; };
+    auto digits = [&](int& v) {
+        v = 0;
+        while (!s.empty() && s[0] >= '0' && s[0] <= '9') {
+            v = v * 10 + (s[0] - '0');
+            s.remove_prefix(1);
+        }
+    };
+
+    if (s.size() > 1 && is_align(s[1])) {
+        r.fill = s[0];
+        r.align = s[1];
+        s.remove_prefix(2);
+    } else if (!s.empty() && is_align(s[0])) {
+        r.align = s[0];
+        s.remove_prefix(1);
+    }
+    if (!s.empty() && s[0] == '+') {
+        r.plus = true;
+        s.remove_prefix(1);
+    }
+    if (!s.empty() && s[0] == '#') {
+        r.alt = true;
+        s.remove_prefix(1);
+    }
+    if (!s.empty() && s[0] == '0') {
+        r.zero = true;
+        s.remove_prefix(1);
+    }
+    digits(r.width);
+    if (!s.empty() && s[0] == '.') {
+        s.remove_prefix(1);
+        digits(r.precision);
+    }
+    if (!s.empty()) r.type = s[0];
+    return r;
+}
+
+struct fmt_span {
+    int l, r;
+    fmt_spec spec;
+};
+
+// bounded output window, counts the full length even past the end
+class fmt_out {
+    char* p_;
+    char* const e_;
+    size_t n_;
 
    public:
-    T* hold(T t) {
-        storage_.push_back(std::move(t));
-        return &storage_.back();
+    fmt_out(char* p, size_t n) : p_{p}, e_{p + n}, n_{0} {}
+
+    void put(std::string_view s) {
+        n_ += s.size();
+        const auto m = std::min(s.size(), (size_t)(e_ - p_));
+        memcpy(p_, s.data(), m);
+        p_ += m;
+    }
+    void put(char c) {
+        ++n_;
+        if (p_ != e_) *p_++ = c;
     }
-    void reset() {
-        storage_.clear();
+    auto size() const {
+        return n_;
     }
 };
 
-using str_holder = holder<std::string>;
+// adapts fmt_out to std::ostream without a heap buffer
+class fmt_streambuf : public std::streambuf {
+    fmt_out& o_;
 
-template <typename T>
-class stringify {
-    str_holder& h_;
-    T t_;
+   protected:
+    int_type overflow(int_type c) override {
+        if (c != traits_type::eof()) o_.put((char)c);
+        return c;
+    }
+    std::streamsize xsputn(const char* s, std::streamsize n) override {
+        o_.put(std::string_view(s, n));
+        return n;
+    }
 
    public:
-    stringify(str_holder& h, T t) : h_{h}, t_{std::move(t)} {}
-    std::string_view operator()() const {
-        std::ostringstream ss;
-        ss << t_;
-        return *h_.hold(ss.str());
+    explicit fmt_streambuf(fmt_out& o) : o_{o} {}
+};
+
+template <typename T, typename = void>
+struct stringify {
+    static void put(fmt_out& o, const T& t) {
+        fmt_streambuf sb{o};
+        std::ostream os{&sb};
+        os << t;
+    }
+};
+template <>
+struct stringify<char> {
+    static void put(fmt_out& o, char c) {
+        o.put(c);
+    }
+};
+template <>
+struct stringify<signed char> : stringify<char> {};
+template <>
+struct stringify<unsigned char> : stringify<char> {};
+template <>
+struct stringify<std::string_view> {
+    static void put(fmt_out& o, std::string_view s) {
+        o.put(s);
+    }
+};
+template <>
+struct stringify<std::string> : stringify<std::string_view> {};
+
+// same output as std::ostream with default flags
+template <>
+struct stringify<bool> {
+    static void put(fmt_out& o, bool b) {
+        o.put(b ? '1' : '0');
     }
 };
 template <typename T>
-class stringify<const T&> {
-    str_holder& h_;
-    const T& t_;
+struct stringify<T, std::enable_if_t<std::is_integral_v<T>>> {
+    static void put(fmt_out& o, T t) {
+        char buf[24];
+        auto r = std::to_chars(buf, buf + sizeof(buf), t);
+        o.put(std::string_view(buf, r.ptr - buf));
+    }
+};
+template <typename T>
+struct stringify<T, std::enable_if_t<std::is_floating_point_v<T>>> {
+    static void put(fmt_out& o, T t) {
+        char buf[32];
+        auto r = std::to_chars(buf, buf + sizeof(buf), t, std::chars_format::general, 6);
+        o.put(std::string_view(buf, r.ptr - buf));
+    }
+};
+template <typename T>
+struct stringify<T, std::enable_if_t<std::is_pointer_v<T>>> {
+    static void put(fmt_out& o, T t) {
+        if (!t) return o.put('0');
+        char buf[2 + 2 * sizeof(T)]{'0', 'x'};
+        auto r = std::to_chars(buf + 2, buf + sizeof(buf), (uintptr_t)t, 16);
+        o.put(std::string_view(buf, r.ptr - buf));
+    }
+};
 
-   public:
-    stringify(str_holder& h, const T& t) : h_{h}, t_{t} {}
-    std::string_view operator()() const {
-        std::ostringstream ss;
-        ss << t_;
-        return *h_.hold(ss.str());
+// an operator<< of the type's own, not the member ones an unscoped enum converts to
+template <typename T, typename = void>
+struct has_own_output : std::false_type {};
+template <typename T>
+struct has_own_output<T, std::void_t<decltype(operator<<(std::declval<std::ostream&>(),
+                                                         std::declval<const T&>()))>>
+    : std::true_type {};
+
+// enums print their underlying value unless they bring their own operator<<
+template <typename T>
+struct stringify<T, std::enable_if_t<std::is_enum_v<T> && !has_own_output<T>::value>> {
+    static void put(fmt_out& o, T t) {
+        stringify<std::underlying_type_t<T>>::put(o, (std::underlying_type_t<T>)t);
     }
 };
-template <>
-class stringify<char> {
-    char c_;
 
-   public:
-    stringify(str_holder&, char c) : c_{c} {}
-    std::string_view operator()() const {
-        return {&c_, 1};
+// emits `head` then `body` padded to the spec's width
+void put_padded(fmt_out& o, const fmt_spec& sp, std::string_view head,
+                std::string_view body, char align);
+
+template <typename T>
+void put_int(fmt_out& o, T t, const fmt_spec& sp) {
+    int base = 10;
+    std::string_view prefix;
+    switch (sp.type) {
+        case 'x':
+            base = 16;
+            prefix = "0x"sv;
+            break;
+        case 'X':
+            base = 16;
+            prefix = "0X"sv;
+            break;
+        case 'o':
+            base = 8;
+            prefix = "0"sv;
+            break;
+        case 'b':
+            base = 2;
+            prefix = "0b"sv;
+            break;
+    }
+    char buf[4 + 8 * sizeof(T)];
+    auto b = buf + 3;
+    auto r = std::to_chars(b, buf + sizeof(buf), t, base);
+    if (sp.type == 'X') {
+        for (auto p = b; p != r.ptr; ++p) {
+            if (*p >= 'a') *p -= 'a' - 'A';
+        }
+    }
+    // sign and prefix go ahead of zero padding
+    int h = 0;
+    if (std::is_signed_v<T> && *b == '-') {
+        ++b;
+        buf[h++] = '-';
+    } else if (sp.plus) {
+        buf[h++] = '+';
     }
+    if (sp.alt) {
+        memcpy(buf + h, prefix.data(), prefix.size());
+        h += prefix.size();
+    }
+    put_padded(o, sp, {buf, (size_t)h}, {b, (size_t)(r.ptr - b)}, '>');
+}
+
+template <typename T>
+void put_float(fmt_out& o, T t, const fmt_spec& sp) {
+    auto f = std::chars_format::general;
+    switch (sp.type) {
+        case 'f':
+        case 'F':
+            f = std::chars_format::fixed;
+            break;
+        case 'e':
+        case 'E':
+            f = std::chars_format::scientific;
+            break;
+    }
+    char buf[352];  // fixed notation of DBL_MAX
+    auto b = buf + 1;
+    auto r = std::to_chars(b, buf + sizeof(buf), t, f, sp.precision < 0 ? 6 : sp.precision);
+    if (r.ec != std::errc{}) return put_padded(o, sp, {}, "?"sv, '>');
+    if (sp.type == 'E' || sp.type == 'F' || sp.type == 'G') {
+        for (auto p = b; p != r.ptr; ++p) {
+            if (*p >= 'a') *p -= 'a' - 'A';
+        }
+    }
+    std::string_view head;
+    if (*b == '-') {
+        head = {b++, 1};
+    } else if (sp.plus) {
+        head = "+"sv;
+    }
+    put_padded(o, sp, head, {b, (size_t)(r.ptr - b)}, '>');
+}
+
+inline void put_pointer(fmt_out& o, const void* t, const fmt_spec& sp) {
+    char buf[2 * sizeof(t)];
+    auto r = std::to_chars(buf, buf + sizeof(buf), (uintptr_t)t, 16);
+    put_padded(o, sp, "0x"sv, {buf, (size_t)(r.ptr - buf)}, '>');
+}
+
+// renders with a spec, after the fast path of stringify
+template <typename U, typename T>
+void put_spec(fmt_out& o, const T& t, const fmt_spec& sp) {
+    if constexpr (std::is_pointer_v<std::decay_t<T>>) {
+        if (sp.type == 'p') return put_pointer(o, (const void*)t, sp);
+    }
+    if constexpr (std::is_same_v<U, std::string_view>) {
+        std::string_view s{t};
+        if (sp.precision >= 0) s = s.substr(0, sp.precision);
+        put_padded(o, sp, {}, s, '<');
+    } else if constexpr (std::is_same_v<U, bool>) {
+        put_int(o, (int)t, sp);
+    } else if constexpr (std::is_same_v<U, char> || std::is_same_v<U, signed char> ||
+                         std::is_same_v<U, unsigned char>) {
+        if (!sp.type || sp.type == 'c') {
+            return put_padded(o, sp, {}, {(const char*)&t, 1}, '<');
+        }
+        put_int(o, (int)t, sp);
+    } else if constexpr (std::is_integral_v<U>) {
+        put_int(o, t, sp);
+    } else if constexpr (std::is_floating_point_v<U>) {
+        put_float(o, t, sp);
+    } else {
+        char buf[128];
+        fmt_out tmp{buf, sizeof(buf)};
+        stringify<U>::put(tmp, t);
+        if (tmp.size() <= sizeof(buf)) {
+            return put_padded(o, sp, {}, {buf, tmp.size()}, '<');
+        }
+        // too long to be padded
+        stringify<U>::put(o, t);
+    }
+}
+
+// type-erased reference to a format argument
+struct fmt_arg {
+    const void* p;
+    void (*put)(fmt_out&, const void*, const fmt_spec&);
 };
-template <>
-class stringify<std::string_view> {
+
+template <typename T>
+fmt_arg make_arg(const T& t) {
+    using U = std::conditional_t<std::is_constructible_v<std::string_view, const T&>,
+                                 std::string_view, T>;
+    return {&t, [](fmt_out& o, const void* p, const fmt_spec& sp) {
+                if (sp.trivial()) {
+                    stringify<U>::put(o, *static_cast<const T*>(p));
+                } else {
+                    put_spec<U>(o, *static_cast<const T*>(p), sp);
+                }
+            }};
+}
+
+void render(fmt_out& o, std::string_view s, const fmt_span* spans, int n,
+            std::bitset<64> slots, const fmt_arg* args, int nargs);
+
+class fmt_parser {
     std::string_view s_;
+    std::bitset<64> slots_;
+    std::vector<fmt_span> spans_;
 
    public:
-    stringify(str_holder&, std::string_view s) : s_{s} {}
-    std::string_view operator()() const {
-        return s_;
-    }
+    fmt_parser(std::string_view s);
+    void apply(fmt_out& o, const fmt_arg* args, int nargs) const;
 };
 
-template <typename T,
-          typename = std::enable_if_t<std::is_constructible_v<std::string_view, T>>>
-stringify(str_holder&, T&&) -> stringify<std::string_view>;
+/*
+   Bounded cache of parsers for runtime format strings: open addressing over hashed
+   keys with a short probe window, evicting within the window by CLOCK when it is full.
 
-extern thread_local str_holder args_holder;
-struct parser_cache {
-    std::shared_mutex m;
-    str_holder h;
-    std::map<std::string_view, std::shared_ptr<fmt_parser>> parser_map;
-    fmt_parser* get(std::string_view fmt);
+   Readers take no lock and do no atomic read-modify-write: each thread announces the
+   epoch it reads in (epoch based reclamation), so writers free evicted entries only
+   once no reader can still hold them. Each thread also keeps a small direct-mapped
+   front cache, dropped whenever an eviction happens.
+ */
+class parser_cache {
+    struct entry {
+        const uint64_t hash;
+        const std::string key;
+        const fmt_parser parser;
+        std::atomic_bool used;  // second chance on eviction
+        entry(uint64_t h, std::string_view s)
+            : hash{h}, key{s}, parser{key}, used{false} {}
+    };
+    struct reader;
+
+    static constexpr int capacity = 1024;
+    static constexpr int probes = 8;
+
+    std::atomic<entry*> slots_[capacity];
+    std::atomic<uint64_t> epoch_;
+    std::atomic<uint64_t> evictions_;
+    // writers and reader registration
+    std::mutex m_;
+    std::vector<reader*> readers_;
+    std::vector<std::pair<uint64_t, entry*>> retired_;
+    int victim_;
+    uint64_t hits_, misses_;  // of exited threads
+
+    reader& local();
+    entry* find(uint64_t h, std::string_view fmt) const;
+    entry* insert(uint64_t h, std::string_view fmt);
+    void reclaim();
+
+   public:
+    struct stats {
+        uint64_t hits, misses, evictions;
+    };
+
+    parser_cache();
+    ~parser_cache();
+
+    void apply(std::string_view fmt, fmt_out& o, const fmt_arg* args, int nargs);
+    stats snapshot();
 };
 extern parser_cache cache;
 
+/*
+   Format string parsed at compile time, e.g. "this {} a test"_fmt. The spans and the
+   slot bitset live in static storage, so formatting skips parser_cache.
+ */
+template <char... Cs>
+class static_fmt {
+    static constexpr char s_[] = {Cs..., '\0'};
+
+    template <int N>
+    struct table {
+        fmt_span spans[N > 0 ? N : 1];
+        uint64_t slots;
+        int n_slots;
+    };
+
+    static constexpr int count() {
+        int n{};
+        parse_fmt(
+            view(), [&](int, int) { ++n; }, [&](int, int) { ++n; });
+        return n;
+    }
+
+    static constexpr auto build() {
+        table<count()> t{};
+        int i{};
+        parse_fmt(
+            view(), [&](int l, int r) { t.spans[i++] = {l, r, {}}; },
+            [&](int l, int r) {
+                t.slots |= 1ull << i;
+                ++t.n_slots;
+                t.spans[i++] = {l, r, parse_spec(view().substr(l + 1, r - l - 1))};
+            });
+        return t;
+    }
+
+   public:
+    static constexpr std::string_view view() {
+        return {s_, sizeof...(Cs)};
+    }
+    static constexpr int n = count();
+    static_assert(n <= 64, "too many slots or escapes in format string");
+    static constexpr auto parsed = build();
+};
+
+// both formats one after the other, e.g. a prefix
+template <char... A, char... B>
+constexpr static_fmt<A..., B...> concat(static_fmt<A...>, static_fmt<B...>) {
+    return {};
+}
+
+/*
+   Renders into [p, p + n) without intermediate strings and returns the formatted
+   size; the output is truncated if the size exceeds `n`, like snprintf.
+ */
 template <typename... ARGS>
-std::string format(std::string_view fmt, ARGS&&... args) {
-    std::vector<std::string_view> v;
-    args_holder.reset();
+size_t format_to(char* p, size_t n, std::string_view fmt, const ARGS&... args) {
+    fmt_out o{p, n};
+    const fmt_arg v[sizeof...(ARGS) + 1]{make_arg(args)...};
+    cache.apply(fmt, o, v, sizeof...(ARGS));
+    return o.size();
+}
+
+template <char... Cs, typename... ARGS>
+size_t format_to(char* p, size_t n, static_fmt<Cs...>, const ARGS&... args) {
+    using fmt = static_fmt<Cs...>;
+    static_assert(fmt::parsed.n_slots == sizeof...(ARGS),
+                  "format: argument count does not match the format string");
+    fmt_out o{p, n};
+    const fmt_arg v[sizeof...(ARGS) + 1]{make_arg(args)...};
+    render(o, fmt::view(), fmt::parsed.spans, fmt::n, fmt::parsed.slots, v,
+           sizeof...(ARGS));
+    return o.size();
+}
 
-    v.reserve(sizeof...(args));
-    (v.push_back(stringify{args_holder, std::forward<ARGS>(args)}()), ...);
+template <typename FMT, typename... ARGS>
+std::string format(FMT fmt, const ARGS&... args) {
+    char buf[256];
+    const auto n = format_to(buf, sizeof(buf), fmt, args...);
+    if (n <= sizeof(buf)) return {buf, n};
 
-    auto p = cache.get(fmt);
-    return p->apply(std::move(v));
+    std::string s(n, '\0');
+    format_to(s.data(), n, fmt, args...);
+    return s;
 }
 
 }  // namespace slog::internal
+
+namespace slog {
+
+template <typename CHAR, CHAR... Cs>
+constexpr internal::static_fmt<Cs...> operator""_fmt() {
+    return {};
+}
+
+}  // namespace slog
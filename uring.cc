@@ -0,0 +1,287 @@
+#include "uring.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+
+namespace slog {
+
+namespace internal {
+
+template <typename T>
+static T* at(void* p, unsigned off) {
+    return reinterpret_cast<T*>(static_cast<char*>(p) + off);
+}
+
+uring::uring(unsigned entries)
+    : fd_{-1},
+      sq_ptr_{MAP_FAILED},
+      cq_ptr_{MAP_FAILED},
+      sqes_{(io_uring_sqe*)MAP_FAILED},
+      tail_{0},
+      pending_{0} {
+    io_uring_params p{};
+    fd_ = syscall(__NR_io_uring_setup, entries, &p);
+    if (fd_ < 0) return;
+
+    sq_len_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_len_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    const bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single) sq_len_ = cq_len_ = std::max(sq_len_, cq_len_);
+
+    sq_ptr_ = mmap(nullptr, sq_len_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   fd_, IORING_OFF_SQ_RING);
+    cq_ptr_ = single ? sq_ptr_
+                     : mmap(nullptr, cq_len_, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+    sqes_len_ = p.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = (io_uring_sqe*)mmap(nullptr, sqes_len_, PROT_READ | PROT_WRITE,
+                                MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+    if (sq_ptr_ == MAP_FAILED || cq_ptr_ == MAP_FAILED || sqes_ == MAP_FAILED) {
+        close(fd_);
+        fd_ = -1;
+        return;
+    }
+
+    sq_head_ = at<unsigned>(sq_ptr_, p.sq_off.head);
+    sq_tail_ = at<unsigned>(sq_ptr_, p.sq_off.tail);
+    sq_array_ = at<unsigned>(sq_ptr_, p.sq_off.array);
+    sq_mask_ = *at<unsigned>(sq_ptr_, p.sq_off.ring_mask);
+    sq_entries_ = p.sq_entries;
+    cq_head_ = at<unsigned>(cq_ptr_, p.cq_off.head);
+    cq_tail_ = at<unsigned>(cq_ptr_, p.cq_off.tail);
+    cqes_ = at<io_uring_cqe>(cq_ptr_, p.cq_off.cqes);
+    cq_mask_ = *at<unsigned>(cq_ptr_, p.cq_off.ring_mask);
+    tail_ = *sq_tail_;
+}
+
+uring::~uring() {
+    if (sqes_ != MAP_FAILED) munmap(sqes_, sqes_len_);
+    if (cq_ptr_ != MAP_FAILED && cq_ptr_ != sq_ptr_) munmap(cq_ptr_, cq_len_);
+    if (sq_ptr_ != MAP_FAILED) munmap(sq_ptr_, sq_len_);
+    if (fd_ >= 0) close(fd_);
+}
+
+bool uring::register_buffers(const iovec* v, unsigned n) {
+    return syscall(__NR_io_uring_register, fd_, IORING_REGISTER_BUFFERS, v, n) == 0;
+}
+
+io_uring_sqe* uring::sqe() {
+    const unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    if (tail_ - head >= sq_entries_) return nullptr;
+    const unsigned i = tail_ & sq_mask_;
+    sq_array_[i] = i;
+    ++tail_;
+    ++pending_;
+    auto e = &sqes_[i];
+    memset(e, 0, sizeof(*e));
+    return e;
+}
+
+int uring::submit(unsigned wait) {
+    __atomic_store_n(sq_tail_, tail_, __ATOMIC_RELEASE);
+    if (pending_ == 0 && wait == 0) return 0;
+    int r;
+    do {
+        r = syscall(__NR_io_uring_enter, fd_, pending_, wait,
+                    wait ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+    } while (r < 0 && errno == EINTR);
+    if (r > 0) pending_ -= std::min<unsigned>(r, pending_);
+    return r;
+}
+
+}  // namespace internal
+
+static constexpr uint64_t fsync_tag = ~0ull;
+
+UringFile::UringFile(int fd, int size, int depth, std::unique_ptr<internal::uring> ring,
+                     std::unique_ptr<char, decltype(&free)> mem)
+    : File{fd, Buf::of(mem.get(), size)},
+      ring_{std::move(ring)},
+      size_{size},
+      mem_{std::move(mem)},
+      cur_{0},
+      off_{(uint64_t)lseek(fd, 0, SEEK_CUR)},
+      syncs_{0},
+      failed_{false} {
+    std::vector<iovec> v;
+    for (int i = 0; i < depth; ++i) {
+        slots_.push_back({mem_.get() + (size_t)i * size, 0, 0, 0, 0, false, false});
+        v.push_back({slots_.back().a, (size_t)size});
+    }
+    fixed_ = ring_->register_buffers(v.data(), v.size());
+}
+
+UringFile::~UringFile() {
+    Close();
+    auto busy = [this] {
+        return syncs_ > 0 ||
+               std::any_of(slots_.begin(), slots_.end(), [](auto& s) { return s.busy; });
+    };
+    // the kernel may still read the buffers
+    while (busy() && reap(1)) {
+    }
+    // the base class flushes an empty buffer
+    buf_ = Buf::of(nullptr, 0);
+}
+
+io_uring_sqe* UringFile::sqe() {
+    io_uring_sqe* e;
+    while (!(e = ring_->sqe())) reap(1);
+    return e;
+}
+
+void UringFile::submit_write(int i) {
+    auto& s = slots_[i];
+    auto e = sqe();
+    e->opcode = fixed_ ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+    e->fd = fd_;
+    e->addr = (uint64_t)(s.a + s.done);
+    e->len = s.len - s.done;
+    e->off = s.off + s.done;
+    e->buf_index = i;
+    e->user_data = i;
+    if (metrics_) metrics_->writes.fetch_add(1, std::memory_order_relaxed);
+}
+
+// returns false if the ring itself is broken
+bool UringFile::reap(unsigned wait) {
+    if (wait && ring_->submit(wait) < 0) {
+        failed_ = true;
+        return false;
+    }
+    ring_->reap([this](uint64_t i, int res) {
+        if (i == fsync_tag) {
+            --syncs_;
+            // a failed link cancels the fadvise
+            if (res < 0 && res != -ECANCELED) failed_ = true;
+            return;
+        }
+        auto& s = slots_[i];
+        if (res > 0 && metrics_) {
+            metrics_->written.fetch_add(res, std::memory_order_relaxed);
+        }
+        if (res == -EINTR || res == -EAGAIN) {
+            s.retry = true;
+        } else if (res <= 0) {
+            failed_ = true;
+            s.busy = false;
+        } else if ((s.done += res) < s.len) {
+            // short write
+            s.retry = true;
+        } else {
+            s.busy = false;
+            if (metrics_) metrics_->write_ns.Add(internal::monotonic_nanos() - s.start);
+        }
+    });
+    for (int i = 0, n = slots_.size(); i < n; ++i) {
+        if (!slots_[i].retry) continue;
+        slots_[i].retry = false;
+        submit_write(i);
+    }
+    return true;
+}
+
+bool UringFile::Drain() {
+    auto r = buf_.Rewind();
+    if (r.empty()) return !failed_;
+
+    auto& s = slots_[cur_];
+    s.off = off_;
+    s.len = r.size();
+    s.done = 0;
+    s.start = metrics_ ? internal::monotonic_nanos() : 0;
+    s.busy = true;
+    off_ += r.size();
+    submit_write(cur_);
+    ring_->submit(0);
+
+    // switch buffers, blocking only if every one is in flight
+    cur_ = (cur_ + 1) % slots_.size();
+    reap(0);
+    while (slots_[cur_].busy && reap(1)) {
+    }
+    buf_ = Buf::of(slots_[cur_].a, size_);
+    return !failed_;
+}
+
+size_t UringFile::Headroom() {
+    reap(0);
+    return slots_[(cur_ + 1) % slots_.size()].busy ? buf_.Room() : size_;
+}
+
+bool UringFile::Put(std::string_view s) {
+    while (!s.empty()) {
+        auto n = internal::counted_write(
+            metrics_, [&] { return pwrite(fd_, s.data(), s.size(), off_); });
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        off_ += n;
+        s.remove_prefix(n);
+    }
+    return true;
+}
+
+io_uring_sqe* UringFile::sync_sqe(uint8_t opcode, uint8_t flags) {
+    auto e = sqe();
+    e->opcode = opcode;
+    e->fd = fd_;
+    e->flags = flags;
+    e->user_data = fsync_tag;
+    ++syncs_;
+    return e;
+}
+
+bool UringFile::Datasync() {
+    if (metrics_) metrics_->syncs.fetch_add(1, std::memory_order_relaxed);
+    auto e = sync_sqe(IORING_OP_FSYNC, IOSQE_IO_DRAIN | (fadvise_ ? IOSQE_IO_LINK : 0));
+    e->fsync_flags = IORING_FSYNC_DATASYNC;
+    if (fadvise_) {
+        // linked, runs once the data is clean
+        sync_sqe(IORING_OP_FADVISE, 0)->fadvise_advice = POSIX_FADV_DONTNEED;
+    }
+    ring_->submit(0);
+    return !failed_;
+}
+
+bool UringFile::Writeback() {
+    if (fadvise_) Advise(synced_);
+    if (off_ <= synced_) return !failed_;
+    auto e = sync_sqe(IORING_OP_SYNC_FILE_RANGE, IOSQE_IO_DRAIN);
+    e->off = synced_;
+    e->len = off_ - synced_;
+    e->sync_range_flags = SYNC_FILE_RANGE_WRITE;
+    synced_ = off_;
+    ring_->submit(0);
+    return !failed_;
+}
+
+ssize_t UringFile::Splice(int fd, size_t n) {
+    if (!Drain()) return -1;
+    loff_t off = off_;
+    auto r = splice(fd, nullptr, fd_, &off, n, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    off_ = off;
+    return r;
+}
+
+std::shared_ptr<File> UringFile::of(int fd, int buf_size, int depth) {
+    struct stat st {};
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) return nullptr;
+
+    auto ring = std::make_unique<internal::uring>(depth + 2);
+    if (!ring->ok()) return nullptr;
+    void* p{};
+    if (posix_memalign(&p, 4096, (size_t)buf_size * depth) != 0) return nullptr;
+
+    return std::make_shared<trampoline<UringFile>>(
+        fd, buf_size, depth, std::move(ring),
+        std::unique_ptr<char, decltype(&free)>{(char*)p, &free});
+}
+
+}  // namespace slog
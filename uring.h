@@ -0,0 +1,117 @@
+#pragma once
+
+#include <linux/io_uring.h>
+#include <sys/uio.h>
+#include <memory>
+#include <vector>
+#include "file.h"
+
+namespace slog {
+
+namespace internal {
+
+// minimal io_uring over raw syscalls
+class uring {
+    int fd_;
+    void* sq_ptr_;
+    size_t sq_len_;
+    void* cq_ptr_;
+    size_t cq_len_;
+    io_uring_sqe* sqes_;
+    size_t sqes_len_;
+    unsigned* sq_head_;
+    unsigned* sq_tail_;
+    unsigned* sq_array_;
+    unsigned sq_mask_;
+    unsigned sq_entries_;
+    unsigned* cq_head_;
+    unsigned* cq_tail_;
+    io_uring_cqe* cqes_;
+    unsigned cq_mask_;
+    unsigned tail_;     // local sq tail
+    unsigned pending_;  // prepared but not submitted
+
+   public:
+    explicit uring(unsigned entries);
+    ~uring();
+    uring(const uring&) = delete;
+
+    bool ok() const {
+        return fd_ >= 0;
+    }
+    bool register_buffers(const iovec* v, unsigned n);
+
+    // nullptr if the submission queue is full
+    io_uring_sqe* sqe();
+    // submits prepared entries, waiting for `wait` completions
+    int submit(unsigned wait);
+
+    template <typename F>
+    unsigned reap(F&& f) {
+        unsigned head = *cq_head_;
+        const unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+        const unsigned n = tail - head;
+        for (; head != tail; ++head) {
+            auto& e = cqes_[head & cq_mask_];
+            f(e.user_data, e.res);
+        }
+        __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+        return n;
+    }
+};
+
+}  // namespace internal
+
+/*
+   File backend writing through io_uring. Full buffers are submitted as fixed-buffer
+   writes at explicit offsets and the producer moves on to the next free buffer; it
+   blocks only when all of them are in flight. Syncs are submitted ordered after the
+   pending writes and never waited for.
+ */
+class UringFile : public File {
+    struct slot {
+        char* a;
+        uint64_t off;
+        uint32_t len;
+        uint32_t done;
+        int64_t start;  // monotonic ns of the submission
+        bool busy;
+        bool retry;
+    };
+
+    std::unique_ptr<internal::uring> ring_;
+    const int size_;
+    std::unique_ptr<char, decltype(&free)> mem_;
+    std::vector<slot> slots_;
+    bool fixed_;
+    int cur_;
+    uint64_t off_;
+    int syncs_;  // fdatasync in flight
+    bool failed_;
+
+    io_uring_sqe* sqe();
+    io_uring_sqe* sync_sqe(uint8_t opcode, uint8_t flags);
+    void submit_write(int i);
+    bool reap(unsigned wait);
+
+   protected:
+    bool Drain() override;
+    bool Put(std::string_view s) override;
+    bool Datasync() override;
+    bool Writeback() override;
+
+    UringFile(int fd, int size, int depth, std::unique_ptr<internal::uring> ring,
+              std::unique_ptr<char, decltype(&free)> mem);
+    friend class trampoline<UringFile>;
+
+   public:
+    ~UringFile() override;
+
+    size_t Headroom() override;
+    ssize_t Splice(int fd, size_t n) override;
+
+    // nullptr if io_uring is not available or `fd` is not a regular file
+    static std::shared_ptr<File> of(int fd, int buf_size, int depth);
+};
+
+}  // namespace slog